@@ -0,0 +1,407 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h> // for `memcpy()`
+#if defined(__x86_64__) || defined(_M_X64)
+#include <emmintrin.h> // SSE2 [always available on x86-64]
+#ifdef _MSC_VER
+#include <nmmintrin.h> // for `_mm_crc32_u64()`
+#include <intrin.h>    // for `__cpuid()` and `_umul128()`
+#endif
+#elif defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#endif
+
+/*
+Streaming checksums, which can be computed along with reading/writing of a file [see `IFile::set_checksum()` and `OFile::set_checksum()`]:
+    Checksum cs(ChecksumType::crc32c);
+    IFile f(fname);
+    f.set_checksum(&cs);
+    ... // read the file
+    if (cs.value() != expected) ...
+*/
+namespace detail
+{
+inline uint64_t read64(const uint8_t *p) {uint64_t v; memcpy(&v, p, 8); return v;} // little-endian byte order is assumed
+inline uint32_t read32(const uint8_t *p) {uint32_t v; memcpy(&v, p, 4); return v;}
+
+// CRC32C [Castagnoli]
+struct Crc32cTable
+{
+    uint32_t t[8][256]; // tables for processing 8 bytes at a time [‘slicing-by-8’]
+
+    Crc32cTable()
+    {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; k++)
+                c = c & 1 ? (c >> 1) ^ 0x82F63B78 : c >> 1;
+            t[0][i] = c;
+        }
+        for (uint32_t i = 0; i < 256; i++)
+            for (int k = 1; k < 8; k++)
+                t[k][i] = (t[k - 1][i] >> 8) ^ t[0][t[k - 1][i] & 0xFF];
+    }
+};
+
+inline uint32_t crc32c_sw(uint32_t crc, const uint8_t *p, size_t n)
+{
+    static const Crc32cTable table;
+    const uint32_t (&t)[8][256] = table.t;
+    for (; n >= 8; p += 8, n -= 8) {
+        uint64_t v = read64(p) ^ crc;
+        crc = t[7][v & 0xFF] ^ t[6][(v >> 8) & 0xFF] ^ t[5][(v >> 16) & 0xFF] ^ t[4][(v >> 24) & 0xFF]
+            ^ t[3][(v >> 32) & 0xFF] ^ t[2][(v >> 40) & 0xFF] ^ t[1][(v >> 48) & 0xFF] ^ t[0][v >> 56];
+    }
+    for (; n != 0; p++, n--)
+        crc = (crc >> 8) ^ t[0][(crc ^ *p) & 0xFF];
+    return crc;
+}
+
+#if defined(__x86_64__) && defined(__GNUC__)
+__attribute__((target("sse4.2"))) inline uint32_t crc32c_hw(uint32_t crc, const uint8_t *p, size_t n)
+{
+    uint64_t c = crc;
+    for (; n >= 8; p += 8, n -= 8)
+        c = __builtin_ia32_crc32di(c, read64(p));
+    for (; n != 0; p++, n--)
+        c = __builtin_ia32_crc32qi((uint32_t)c, *p);
+    return (uint32_t)c;
+}
+inline bool crc32c_hw_supported() {static const bool r = __builtin_cpu_supports("sse4.2"); return r;}
+#elif defined(_M_X64) && defined(_MSC_VER)
+inline uint32_t crc32c_hw(uint32_t crc, const uint8_t *p, size_t n)
+{
+    uint64_t c = crc;
+    for (; n >= 8; p += 8, n -= 8)
+        c = _mm_crc32_u64(c, read64(p));
+    for (; n != 0; p++, n--)
+        c = _mm_crc32_u8((uint32_t)c, *p);
+    return (uint32_t)c;
+}
+inline bool crc32c_hw_supported()
+{
+    static const bool r = []{int info[4]; __cpuid(info, 1); return (info[2] & (1 << 20)) != 0;}();
+    return r;
+}
+#elif defined(__ARM_FEATURE_CRC32)
+inline uint32_t crc32c_hw(uint32_t crc, const uint8_t *p, size_t n)
+{
+    for (; n >= 8; p += 8, n -= 8)
+        crc = __crc32cd(crc, read64(p));
+    for (; n != 0; p++, n--)
+        crc = __crc32cb(crc, *p);
+    return crc;
+}
+inline bool crc32c_hw_supported() {return true;}
+#else
+inline uint32_t crc32c_hw(uint32_t crc, const uint8_t *p, size_t n) {return crc32c_sw(crc, p, n);}
+inline bool crc32c_hw_supported() {return false;}
+#endif
+
+// XXH3 [64-bit, with the default secret and seed 0; see https://github.com/Cyan4973/xxHash/blob/dev/doc/xxhash_spec.md]
+namespace xxh3
+{
+const uint64_t PRIME32_1 = 0x9E3779B1U, PRIME32_2 = 0x85EBCA77U, PRIME32_3 = 0xC2B2AE3DU;
+const uint64_t PRIME64_1 = 0x9E3779B185EBCA87ULL, PRIME64_2 = 0xC2B2AE3D27D4EB4FULL, PRIME64_3 = 0x165667B19E3779F9ULL,
+               PRIME64_4 = 0x85EBCA77C2B2AE63ULL, PRIME64_5 = 0x27D4EB2F165667C5ULL;
+const size_t STRIPE_LEN = 64, SECRET_SIZE = 192, STRIPES_PER_BLOCK = (SECRET_SIZE - STRIPE_LEN) / 8, BUFFER_SIZE = 256;
+
+alignas(64) const uint8_t SECRET[SECRET_SIZE] = {
+    0xb8, 0xfe, 0x6c, 0x39, 0x23, 0xa4, 0x4b, 0xbe, 0x7c, 0x01, 0x81, 0x2c, 0xf7, 0x21, 0xad, 0x1c,
+    0xde, 0xd4, 0x6d, 0xe9, 0x83, 0x90, 0x97, 0xdb, 0x72, 0x40, 0xa4, 0xa4, 0xb7, 0xb3, 0x67, 0x1f,
+    0xcb, 0x79, 0xe6, 0x4e, 0xcc, 0xc0, 0xe5, 0x78, 0x82, 0x5a, 0xd0, 0x7d, 0xcc, 0xff, 0x72, 0x21,
+    0xb8, 0x08, 0x46, 0x74, 0xf7, 0x43, 0x24, 0x8e, 0xe0, 0x35, 0x90, 0xe6, 0x81, 0x3a, 0x26, 0x4c,
+    0x3c, 0x28, 0x52, 0xbb, 0x91, 0xc3, 0x00, 0xcb, 0x88, 0xd0, 0x65, 0x8b, 0x1b, 0x53, 0x2e, 0xa3,
+    0x71, 0x64, 0x48, 0x97, 0xa2, 0x0d, 0xf9, 0x4e, 0x38, 0x19, 0xef, 0x46, 0xa9, 0xde, 0xac, 0xd8,
+    0xa8, 0xfa, 0x76, 0x3f, 0xe3, 0x9c, 0x34, 0x3f, 0xf9, 0xdc, 0xbb, 0xc7, 0xc7, 0x0b, 0x4f, 0x1d,
+    0x8a, 0x51, 0xe0, 0x4b, 0xcd, 0xb4, 0x59, 0x31, 0xc8, 0x9f, 0x7e, 0xc9, 0xd9, 0x78, 0x73, 0x64,
+    0xea, 0xc5, 0xac, 0x83, 0x34, 0xd3, 0xeb, 0xc3, 0xc5, 0x81, 0xa0, 0xff, 0xfa, 0x13, 0x63, 0xeb,
+    0x17, 0x0d, 0xdd, 0x51, 0xb7, 0xf0, 0xda, 0x49, 0xd3, 0x16, 0x55, 0x26, 0x29, 0xd4, 0x68, 0x9e,
+    0x2b, 0x16, 0xbe, 0x58, 0x7d, 0x47, 0xa1, 0xfc, 0x8f, 0xf8, 0xb8, 0xd1, 0x7a, 0xd0, 0x31, 0xce,
+    0x45, 0xcb, 0x3a, 0x8f, 0x95, 0x16, 0x04, 0x28, 0xaf, 0xd7, 0xfb, 0xca, 0xbb, 0x4b, 0x40, 0x7e,
+};
+
+inline uint64_t mul128_fold64(uint64_t a, uint64_t b)
+{
+#if defined(__SIZEOF_INT128__)
+    __extension__ typedef unsigned __int128 uint128; // `__extension__` silences `-Wpedantic`
+    uint128 r = (uint128)a * b;
+    return uint64_t(r) ^ uint64_t(r >> 64);
+#elif defined(_M_X64) && defined(_MSC_VER)
+    uint64_t hi, lo = _umul128(a, b, &hi);
+    return lo ^ hi;
+#else
+    uint64_t lo_lo = (a & 0xFFFFFFFF) * (b & 0xFFFFFFFF), hi_lo = (a >> 32) * (b & 0xFFFFFFFF),
+             lo_hi = (a & 0xFFFFFFFF) * (b >> 32),        hi_hi = (a >> 32) * (b >> 32);
+    uint64_t cross = (lo_lo >> 32) + (hi_lo & 0xFFFFFFFF) + lo_hi;
+    uint64_t upper = (hi_lo >> 32) + (cross >> 32) + hi_hi;
+    uint64_t lower = (cross << 32) | (lo_lo & 0xFFFFFFFF);
+    return lower ^ upper;
+#endif
+}
+
+inline uint64_t rotl64(uint64_t x, int r) {return (x << r) | (x >> (64 - r));}
+inline uint64_t swap64(uint64_t x)
+{
+    x = ((x & 0x00FF00FF00FF00FFULL) << 8) | ((x >> 8) & 0x00FF00FF00FF00FFULL);
+    x = ((x & 0x0000FFFF0000FFFFULL) << 16) | ((x >> 16) & 0x0000FFFF0000FFFFULL);
+    return (x << 32) | (x >> 32);
+}
+
+inline uint64_t xxh64_avalanche(uint64_t h)
+{
+    h ^= h >> 33;
+    h *= PRIME64_2;
+    h ^= h >> 29;
+    h *= PRIME64_3;
+    return h ^ (h >> 32);
+}
+
+inline uint64_t avalanche(uint64_t h)
+{
+    h ^= h >> 37;
+    h *= 0x165667919E3779F9ULL;
+    return h ^ (h >> 32);
+}
+
+inline uint64_t rrmxmx(uint64_t h, uint64_t len)
+{
+    h ^= rotl64(h, 49) ^ rotl64(h, 24);
+    h *= 0x9FB21C651E98DF25ULL;
+    h ^= (h >> 35) + len;
+    h *= 0x9FB21C651E98DF25ULL;
+    return h ^ (h >> 28);
+}
+
+inline uint64_t mix16(const uint8_t *p, const uint8_t *secret)
+{
+    return mul128_fold64(read64(p) ^ read64(secret), read64(p + 8) ^ read64(secret + 8));
+}
+
+inline uint64_t hash_short(const uint8_t *p, size_t len) // `len` <= 240
+{
+    const uint8_t *s = SECRET;
+    if (len <= 16) {
+        if (len > 8) {
+            uint64_t lo = read64(p) ^ (read64(s + 24) ^ read64(s + 32)), hi = read64(p + len - 8) ^ (read64(s + 40) ^ read64(s + 48));
+            return avalanche(len + swap64(lo) + hi + mul128_fold64(lo, hi));
+        }
+        if (len >= 4) {
+            uint64_t input = read32(p + len - 4) + (uint64_t(read32(p)) << 32);
+            return rrmxmx(input ^ (read64(s + 8) ^ read64(s + 16)), len);
+        }
+        if (len > 0) {
+            uint32_t combined = (uint32_t(p[0]) << 16) | (uint32_t(p[len >> 1]) << 24) | p[len - 1] | (uint32_t(len) << 8);
+            return xxh64_avalanche(combined ^ uint64_t(read32(s) ^ read32(s + 4)));
+        }
+        return xxh64_avalanche(read64(s + 56) ^ read64(s + 64));
+    }
+
+    uint64_t acc = len * PRIME64_1;
+    if (len <= 128) {
+        if (len > 32) {
+            if (len > 64) {
+                if (len > 96) {
+                    acc += mix16(p + 48, s + 96);
+                    acc += mix16(p + len - 64, s + 112);
+                }
+                acc += mix16(p + 32, s + 64);
+                acc += mix16(p + len - 48, s + 80);
+            }
+            acc += mix16(p + 16, s + 32);
+            acc += mix16(p + len - 32, s + 48);
+        }
+        acc += mix16(p, s);
+        acc += mix16(p + len - 16, s + 16);
+        return avalanche(acc);
+    }
+
+    for (size_t i = 0; i < 8; i++)
+        acc += mix16(p + 16 * i, s + 16 * i);
+    uint64_t acc_end = mix16(p + len - 16, s + 136 - 17);
+    acc = avalanche(acc);
+    for (size_t i = 8; i < len / 16; i++)
+        acc_end += mix16(p + 16 * i, s + 16 * (i - 8) + 3);
+    return avalanche(acc + acc_end);
+}
+
+inline void accumulate_512(uint64_t *acc, const uint8_t *p, const uint8_t *secret)
+{
+#if defined(__x86_64__) || defined(_M_X64)
+    __m128i *a = (__m128i*)acc;
+    for (int i = 0; i < 4; i++) {
+        __m128i data = _mm_loadu_si128((const __m128i*)p + i);
+        __m128i data_key = _mm_xor_si128(data, _mm_loadu_si128((const __m128i*)secret + i));
+        __m128i product = _mm_mul_epu32(data_key, _mm_shuffle_epi32(data_key, _MM_SHUFFLE(0, 3, 0, 1))); // low 32 bits * high 32 bits of each lane
+        __m128i sum = _mm_add_epi64(_mm_load_si128(a + i), _mm_shuffle_epi32(data, _MM_SHUFFLE(1, 0, 3, 2))); // the lanes of `data` are swapped
+        _mm_store_si128(a + i, _mm_add_epi64(product, sum));
+    }
+#else
+    for (int i = 0; i < 8; i++) {
+        uint64_t data = read64(p + 8 * i), data_key = data ^ read64(secret + 8 * i);
+        acc[i ^ 1] += data;
+        acc[i] += (data_key & 0xFFFFFFFF) * (data_key >> 32);
+    }
+#endif
+}
+
+inline void scramble(uint64_t *acc, const uint8_t *secret)
+{
+#if defined(__x86_64__) || defined(_M_X64)
+    __m128i *a = (__m128i*)acc;
+    const __m128i prime = _mm_set1_epi32((int)PRIME32_1);
+    for (int i = 0; i < 4; i++) {
+        __m128i v = _mm_load_si128(a + i);
+        v = _mm_xor_si128(_mm_xor_si128(v, _mm_srli_epi64(v, 47)), _mm_loadu_si128((const __m128i*)secret + i));
+        __m128i lo = _mm_mul_epu32(v, prime), hi = _mm_mul_epu32(_mm_shuffle_epi32(v, _MM_SHUFFLE(0, 3, 0, 1)), prime);
+        _mm_store_si128(a + i, _mm_add_epi64(lo, _mm_slli_epi64(hi, 32)));
+    }
+#else
+    for (int i = 0; i < 8; i++) {
+        uint64_t v = acc[i];
+        v ^= v >> 47;
+        v ^= read64(secret + 8 * i);
+        acc[i] = v * PRIME32_1;
+    }
+#endif
+}
+
+// Processes `n` stripes, scrambling the accumulators at the end of each block
+inline const uint8_t *consume_stripes(uint64_t *acc, size_t &stripes_so_far, const uint8_t *p, size_t n)
+{
+    while (n >= STRIPES_PER_BLOCK - stripes_so_far) {
+        size_t k = STRIPES_PER_BLOCK - stripes_so_far;
+        for (size_t i = 0; i < k; i++)
+            accumulate_512(acc, p + i * STRIPE_LEN, SECRET + (stripes_so_far + i) * 8);
+        scramble(acc, SECRET + SECRET_SIZE - STRIPE_LEN);
+        p += k * STRIPE_LEN;
+        n -= k;
+        stripes_so_far = 0;
+    }
+    for (size_t i = 0; i < n; i++)
+        accumulate_512(acc, p + i * STRIPE_LEN, SECRET + (stripes_so_far + i) * 8);
+    stripes_so_far += n;
+    return p + n * STRIPE_LEN;
+}
+}
+}
+
+class Crc32c
+{
+    uint32_t crc = 0xFFFFFFFF;
+
+public:
+    void update(const void *data, size_t size)
+    {
+        crc = detail::crc32c_hw_supported() ? detail::crc32c_hw(crc, (const uint8_t*)data, size) : detail::crc32c_sw(crc, (const uint8_t*)data, size);
+    }
+
+    uint32_t value() const {return ~crc;}
+    void reset() {crc = 0xFFFFFFFF;}
+};
+
+class Xxh3
+{
+    alignas(16) uint64_t acc[8];
+    alignas(16) uint8_t buffer[detail::xxh3::BUFFER_SIZE];
+    size_t buffered = 0, stripes_so_far = 0;
+    uint64_t total_len = 0;
+
+public:
+    Xxh3() {reset();}
+
+    void reset()
+    {
+        using namespace detail::xxh3;
+        const uint64_t init[8] = {PRIME32_3, PRIME64_1, PRIME64_2, PRIME64_3, PRIME64_4, PRIME32_2, PRIME64_5, PRIME32_1};
+        memcpy(acc, init, sizeof(acc));
+        buffered = stripes_so_far = 0;
+        total_len = 0;
+    }
+
+    void update(const void *data, size_t size)
+    {
+        using namespace detail::xxh3;
+        const uint8_t *p = (const uint8_t*)data, *end = p + size;
+        total_len += size;
+        if (size <= BUFFER_SIZE - buffered) {
+            memcpy(buffer + buffered, p, size);
+            buffered += size;
+            return;
+        }
+
+        // The input does not fit in the buffer, so all full stripes except the last one are processed
+        // [the last stripe is kept, as it is processed differently if it turns out to be the last one of the input]
+        if (buffered != 0) {
+            size_t k = BUFFER_SIZE - buffered;
+            memcpy(buffer + buffered, p, k);
+            p += k;
+            consume_stripes(acc, stripes_so_far, buffer, BUFFER_SIZE / STRIPE_LEN);
+            buffered = 0;
+        }
+        if (size_t(end - p) > BUFFER_SIZE) {
+            p = consume_stripes(acc, stripes_so_far, p, (end - 1 - p) / STRIPE_LEN);
+            memcpy(buffer + BUFFER_SIZE - STRIPE_LEN, p - STRIPE_LEN, STRIPE_LEN); // for the last stripe of the input, if there is less than a stripe after it
+        }
+        memcpy(buffer, p, end - p);
+        buffered = end - p;
+    }
+
+    uint64_t value() const
+    {
+        using namespace detail::xxh3;
+        if (total_len <= 240)
+            return hash_short(buffer, (size_t)total_len);
+
+        alignas(16) uint64_t a[8];
+        memcpy(a, acc, sizeof(a));
+        const uint8_t *last_stripe;
+        uint8_t tmp[STRIPE_LEN];
+        if (buffered >= STRIPE_LEN) {
+            size_t so_far = stripes_so_far;
+            consume_stripes(a, so_far, buffer, (buffered - 1) / STRIPE_LEN);
+            last_stripe = buffer + buffered - STRIPE_LEN;
+        }
+        else { // the last stripe is assembled from the end of the previous data and the buffered bytes
+            size_t catchup = STRIPE_LEN - buffered;
+            memcpy(tmp, buffer + BUFFER_SIZE - catchup, catchup);
+            memcpy(tmp + catchup, buffer, buffered);
+            last_stripe = tmp;
+        }
+        accumulate_512(a, last_stripe, SECRET + SECRET_SIZE - STRIPE_LEN - 7);
+
+        uint64_t result = total_len * PRIME64_1;
+        for (int i = 0; i < 4; i++)
+            result += mul128_fold64(a[2 * i] ^ detail::read64(SECRET + 11 + 16 * i), a[2 * i + 1] ^ detail::read64(SECRET + 11 + 16 * i + 8));
+        return avalanche(result);
+    }
+};
+
+enum class ChecksumType {crc32c, xxh3};
+
+class Checksum
+{
+    ChecksumType type;
+    Crc32c crc32c;
+    Xxh3 xxh3;
+
+public:
+    explicit Checksum(ChecksumType type = ChecksumType::crc32c) : type(type) {}
+
+    void update(const void *data, size_t size)
+    {
+        if (type == ChecksumType::crc32c)
+            crc32c.update(data, size);
+        else
+            xxh3.update(data, size);
+    }
+
+    uint64_t value() const {return type == ChecksumType::crc32c ? crc32c.value() : xxh3.value();}
+
+    void reset()
+    {
+        crc32c.reset();
+        xxh3.reset();
+    }
+};
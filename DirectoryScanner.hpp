@@ -0,0 +1,263 @@
+#pragma once
+#include "FileHandle.hpp"
+#include <vector>
+#include <thread>
+#include <exception> // for std::exception_ptr
+#include <type_traits> // for std::remove_reference
+#ifndef _WIN32
+#include <dirent.h> // for `DT_*` constants
+#endif
+
+class ReadDirectoryFailed {};
+
+enum class DirEntryType {unknown, regular, directory, symlink, other};
+
+struct DirEntry
+{
+    std::string path; // path of the entry, i.e. the root directory path followed by the path relative to it
+    size_t name_offset = 0;
+    DirEntryType type = DirEntryType::unknown;
+    int64_t size = -1; // -1 if metadata is not requested, -2 if the entry is not a regular file
+    UnixNanotime last_write_time = UnixNanotime::uninitialized(); // uninitialized if metadata is not requested
+
+    const char *name() const {return path.c_str() + name_offset;}
+};
+
+namespace detail
+{
+template <class Callback> class DirectoryScanner
+{
+    Callback &callback;
+    bool fetch_metadata;
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::vector<std::string> pending; // directories to scan [used as a stack, so that a single thread scans the tree depth-first]
+    unsigned active = 0; // number of directories being scanned right now
+    std::exception_ptr error;
+    std::string root;
+    std::vector<std::string> *unreadable_dirs; // subdirectories which could not be opened [e.g. because of permissions or because they were removed during the scan]
+
+#ifdef _WIN32
+    static const int64_t _1601_TO_1970 = 116444736000000000i64;
+
+    bool scan(const std::string &dir, DirEntry &e, std::vector<std::string> &subdirs) // returns false if the directory can not be opened
+    {
+        e.path = dir;
+        if (e.path.empty() || (e.path.back() != '/' && e.path.back() != '\\'))
+            e.path += '\\';
+        size_t base_len = e.path.size();
+
+        WIN32_FIND_DATAW fd;
+        HANDLE h = FindFirstFileExW((wchar_t*)utf::as_u16(e.path + '*').c_str(), FindExInfoBasic, &fd, FindExSearchNameMatch, NULL, FIND_FIRST_EX_LARGE_FETCH);
+        if (h == INVALID_HANDLE_VALUE)
+            return false;
+        struct FindHandle {HANDLE h; ~FindHandle() {FindClose(h);}} find_handle = {h};
+
+        do {
+            if (fd.cFileName[0] == L'.' && (fd.cFileName[1] == 0 || (fd.cFileName[1] == L'.' && fd.cFileName[2] == 0)))
+                continue;
+            e.path.resize(base_len);
+            e.path += utf::as_str8((char16_t*)fd.cFileName);
+            e.name_offset = base_len;
+            e.type = fd.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT ? DirEntryType::symlink
+                   : fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY     ? DirEntryType::directory : DirEntryType::regular;
+            if (fetch_metadata) { // the metadata comes with the directory entry for free
+                e.size = e.type == DirEntryType::regular ? int64_t((uint64_t(fd.nFileSizeHigh) << 32) | fd.nFileSizeLow) : -2;
+                uint64_t mfiletime = (uint64_t(fd.ftLastWriteTime.dwHighDateTime) << 32) | fd.ftLastWriteTime.dwLowDateTime;
+                e.last_write_time = UnixNanotime::from_nanotime_t(int64_t(mfiletime - _1601_TO_1970) * 100);
+            }
+            if (e.type == DirEntryType::directory)
+                subdirs.push_back(e.path);
+            callback(const_cast<const DirEntry&>(e));
+        } while (FindNextFileW(h, &fd));
+        return true;
+    }
+#else
+    static DirEntryType type_from_mode(unsigned mode)
+    {
+        return S_ISREG(mode) ? DirEntryType::regular : S_ISDIR(mode) ? DirEntryType::directory : S_ISLNK(mode) ? DirEntryType::symlink : DirEntryType::other;
+    }
+
+    bool stat_entry(int dir_fd, DirEntry &e) // fetches metadata relative to the directory fd [no path resolution from the root]; returns false if the entry has been removed
+    {
+#ifdef __NR_statx
+        struct statx stx;
+        if (syscall(__NR_statx, dir_fd, e.name(), AT_SYMLINK_NOFOLLOW, STATX_TYPE|STATX_SIZE|STATX_MTIME, &stx) == 0) {
+            e.type = type_from_mode(stx.stx_mode);
+            e.size = e.type == DirEntryType::regular ? (int64_t)stx.stx_size : -2;
+            e.last_write_time = UnixNanotime::from_nanotime_t(stx.stx_mtime.tv_sec * 1000000000 + stx.stx_mtime.tv_nsec);
+            return true;
+        }
+        if (errno == ENOENT)
+            return false;
+        // otherwise fall back to `fstatat()` [`statx()` may be unsupported or blocked by a seccomp filter]
+#endif
+        struct stat st;
+        if (fstatat(dir_fd, e.name(), &st, AT_SYMLINK_NOFOLLOW) != 0) {
+            if (errno == ENOENT)
+                return false;
+            throw FStatFailed();
+        }
+        e.type = type_from_mode(st.st_mode);
+        e.size = e.type == DirEntryType::regular ? (int64_t)st.st_size : -2;
+        e.last_write_time = UnixNanotime::from_nanotime_t(st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec);
+        return true;
+    }
+
+    void add_entry(int dir_fd, DirEntry &e, size_t base_len, const char *name, unsigned char d_type, std::vector<std::string> &subdirs)
+    {
+        if (name[0] == '.' && (name[1] == 0 || (name[1] == '.' && name[2] == 0)))
+            return;
+        e.path.resize(base_len);
+        e.path += name;
+        e.name_offset = base_len;
+        switch (d_type) {
+        case DT_REG: e.type = DirEntryType::regular;   break;
+        case DT_DIR: e.type = DirEntryType::directory; break;
+        case DT_LNK: e.type = DirEntryType::symlink;   break;
+        case DT_UNKNOWN: e.type = DirEntryType::unknown; break; // not all file systems fill in `d_type`
+        default: e.type = DirEntryType::other;
+        }
+        if (fetch_metadata || e.type == DirEntryType::unknown)
+            if (!stat_entry(dir_fd, e)) // the entry was removed after it had been read from the directory
+                return;
+        if (!fetch_metadata) {
+            e.size = -1;
+            e.last_write_time = UnixNanotime::uninitialized();
+        }
+        if (e.type == DirEntryType::directory)
+            subdirs.push_back(e.path);
+        callback(const_cast<const DirEntry&>(e));
+    }
+
+    bool scan(const std::string &dir, DirEntry &e, std::vector<std::string> &subdirs) // returns false if the directory can not be opened
+    {
+        e.path = dir;
+        if (e.path.empty() || e.path.back() != '/')
+            e.path += '/';
+        size_t base_len = e.path.size();
+
+#ifdef SYS_getdents64
+        int dir_fd = ::open(dir.c_str(), O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+        if (dir_fd == -1)
+            return false;
+        struct DirFd {int fd; ~DirFd() {::close(fd);}} dir_fd_guard = {dir_fd};
+
+        // Read entries in large batches [`readdir()` uses a 32 KiB buffer in glibc]
+        struct LinuxDirent64
+        {
+            uint64_t d_ino;
+            int64_t d_off;
+            unsigned short d_reclen;
+            unsigned char d_type;
+            char d_name[1];
+        };
+        const size_t BATCH_SIZE = 256*1024;
+        if (batch == nullptr)
+            batch.reset(new uint64_t[BATCH_SIZE / 8]); // `uint64_t` for the alignment of `LinuxDirent64`
+        while (true) {
+            long n = syscall(SYS_getdents64, dir_fd, batch.get(), BATCH_SIZE);
+            if (n == -1)
+                throw ReadDirectoryFailed();
+            if (n == 0)
+                break;
+            for (long off = 0; off < n;) {
+                const LinuxDirent64 *d = (const LinuxDirent64*)((char*)batch.get() + off);
+                add_entry(dir_fd, e, base_len, d->d_name, d->d_type, subdirs);
+                off += d->d_reclen;
+            }
+        }
+#else
+        DIR *d = opendir(dir.c_str());
+        if (d == nullptr)
+            return false;
+        struct DirCloser {DIR *d; ~DirCloser() {closedir(d);}} dir_closer = {d};
+        while (struct dirent *de = readdir(d))
+            add_entry(dirfd(d), e, base_len, de->d_name, de->d_type, subdirs);
+#endif
+        return true;
+    }
+
+    static thread_local std::unique_ptr<uint64_t[]> batch;
+#endif
+
+    void work()
+    {
+        DirEntry e;
+        std::vector<std::string> subdirs;
+        while (true) {
+            std::string dir;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                cv.wait(lock, [this]{return !pending.empty() || active == 0 || error != nullptr;});
+                if (pending.empty() || error != nullptr) // all directories have been scanned [or scanning failed]
+                    return;
+                dir = std::move(pending.back());
+                pending.pop_back();
+                active++;
+            }
+
+            subdirs.clear();
+            try {
+                if (!scan(dir, e, subdirs)) {
+                    if (dir == root) // only a failure to open the root stops the scan
+                        throw DirectoryOpenError();
+                    if (unreadable_dirs != nullptr) {
+                        std::lock_guard<std::mutex> lock(mutex);
+                        unreadable_dirs->push_back(dir);
+                    }
+                }
+            }
+            catch (...) {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (error == nullptr)
+                    error = std::current_exception();
+                active--;
+                cv.notify_all();
+                return;
+            }
+
+            std::lock_guard<std::mutex> lock(mutex);
+            active--;
+            for (auto it = subdirs.rbegin(); it != subdirs.rend(); ++it) // reverse order, so that subdirectories are scanned in the order of the directory listing
+                pending.push_back(std::move(*it));
+            if (!subdirs.empty() || active == 0)
+                cv.notify_all();
+        }
+    }
+
+public:
+    DirectoryScanner(Callback &callback, bool fetch_metadata, std::vector<std::string> *unreadable_dirs) : callback(callback), fetch_metadata(fetch_metadata), unreadable_dirs(unreadable_dirs) {}
+
+    void run(const std::string &root_dir, unsigned threads)
+    {
+        root = root_dir;
+        pending.push_back(root);
+        std::vector<std::thread> workers;
+        for (unsigned i = 1; i < threads; i++)
+            workers.emplace_back(&DirectoryScanner::work, this);
+        work(); // the calling thread is a worker too
+        for (auto &w : workers)
+            w.join();
+        if (error != nullptr)
+            std::rethrow_exception(error);
+    }
+};
+
+#ifndef _WIN32
+template <class Callback> thread_local std::unique_ptr<uint64_t[]> DirectoryScanner<Callback>::batch;
+#endif
+}
+
+// Calls `callback(const DirEntry &)` for each entry in the directory tree under `root` [symbolic links are not followed].
+// If `fetch_metadata` is true, the size and the last write time of each entry are fetched [via `statx()` relative to the directory fd on Linux].
+// If `threads` > 1, subtrees are scanned by several threads, and `callback` is called concurrently from all of them.
+// Entries removed during the scan are skipped. Subdirectories which can not be opened [e.g. because of permissions] are skipped too, and their paths are
+// appended to `*unreadable_dirs` if it is not null [`DirectoryOpenError` is thrown only if `root` itself can not be opened].
+template <class Callback> void scan_directory(const std::string &root, Callback &&callback, bool fetch_metadata = false, unsigned threads = 1,
+                                             std::vector<std::string> *unreadable_dirs = nullptr)
+{
+    detail::DirectoryScanner<typename std::remove_reference<Callback>::type> scanner(callback, fetch_metadata, unreadable_dirs);
+    scanner.run(root, threads);
+}
@@ -0,0 +1,144 @@
+#pragma once
+#include "FileHandle.hpp"
+#include <list>
+#include <unordered_map>
+#ifndef _WIN32
+#include <sys/resource.h> // for `getrlimit()`
+#endif
+
+// A read handle shared between all users of a `FileCache` [only positional reads are provided, so that several threads can read the same file at once]
+class CachedFile
+{
+    friend class FileCache;
+    detail::FileHandle<true> fh;
+    FileInfo info; // metadata at the time of opening, which is used to detect changes of the file
+
+public:
+    CachedFile(const std::string &path) : fh(path) {info = fh.get_file_info();}
+
+    size_t read_at(void *buf, size_t sz, int64_t pos) {return fh.read_at(buf, sz, pos);}
+
+    int64_t get_file_size() const {return info.size;}
+    UnixNanotime get_last_write_time() const {return info.last_write_time;}
+    const FileInfo &get_file_info() const {return info;}
+};
+
+/*
+Bounded cache of open read handles keyed by path, so that files which are opened over and over do not pay for `open()`, `fstat()` and `close()` each time:
+    FileCache cache(4096);
+    std::shared_ptr<CachedFile> f = cache.open("/data/shards/part-00000");
+    f->read_at(buf, sizeof(buf), offset);
+A cached handle is reused only if the file at the path still has the same last write time, size and identity [one `stat()` instead of `open()` + `fstat()` + `close()`],
+otherwise the file is reopened. The least recently used handles are evicted when the number of cached handles exceeds the capacity
+[an evicted handle is closed when the last `shared_ptr` to it is released].
+*/
+class FileCache
+{
+    struct Entry
+    {
+        std::string path;
+        std::shared_ptr<CachedFile> file;
+    };
+    std::mutex mutex;
+    std::list<Entry> lru; // the most recently used entries are at the front
+    std::unordered_map<std::string, std::list<Entry>::iterator> index;
+    size_t capacity;
+
+    static bool is_unchanged(const std::string &path, const FileInfo &info) // checks the metadata of the file at `path` against the metadata of the cached handle
+    {
+#ifdef _WIN32
+        WIN32_FILE_ATTRIBUTE_DATA fad;
+        if (GetFileAttributesExW((wchar_t*)utf::as_u16(path).c_str(), GetFileExInfoStandard, &fad) == 0)
+            return false;
+        uint64_t mfiletime = (uint64_t(fad.ftLastWriteTime.dwHighDateTime) << 32) | fad.ftLastWriteTime.dwLowDateTime;
+        return UnixNanotime::from_nanotime_t(int64_t(mfiletime - 116444736000000000i64) * 100) == info.last_write_time
+            && int64_t((uint64_t(fad.nFileSizeHigh) << 32) | fad.nFileSizeLow) == info.size;
+#else
+        struct stat st;
+        if (stat(path.c_str(), &st) != 0)
+            return false;
+        return UnixNanotime::from_nanotime_t(st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec) == info.last_write_time
+            && st.st_size == info.size && st.st_ino == info.inode && st.st_dev == info.device; // the identity check catches a file replaced by `rename()` with the same time and size
+#endif
+    }
+
+    void insert(const std::string &path, const std::shared_ptr<CachedFile> &file) // must be called with `mutex` locked
+    {
+        auto it = index.find(path);
+        if (it != index.end()) {
+            it->second->file = file;
+            lru.splice(lru.begin(), lru, it->second);
+            return;
+        }
+        lru.push_front(Entry{path, file});
+        index.emplace(path, lru.begin());
+        while (lru.size() > capacity) {
+            index.erase(lru.back().path);
+            lru.pop_back();
+        }
+    }
+
+public:
+    // `capacity` is the maximum number of cached handles; on POSIX it is limited to half of the process fd limit [`RLIMIT_NOFILE`], leaving the rest for other files
+    FileCache(size_t capacity = 1024) : capacity(capacity)
+    {
+#ifndef _WIN32
+        struct rlimit rl;
+        if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur != RLIM_INFINITY)
+            this->capacity = std::min(this->capacity, size_t(rl.rlim_cur / 2));
+#endif
+        if (this->capacity == 0)
+            this->capacity = 1;
+    }
+
+    FileCache(const FileCache &) = delete;
+    void operator=(const FileCache &) = delete;
+
+    // Returns a cached handle if it is still valid, otherwise opens the file [throws `FileOpenError` if the file can not be opened]
+    std::shared_ptr<CachedFile> open(const std::string &path)
+    {
+        std::shared_ptr<CachedFile> file;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto it = index.find(path);
+            if (it != index.end()) {
+                file = it->second->file;
+                lru.splice(lru.begin(), lru, it->second);
+            }
+        }
+
+        // The file system is accessed without holding the lock
+        if (file != nullptr && is_unchanged(path, file->info))
+            return file;
+        file = std::make_shared<CachedFile>(path);
+
+        std::lock_guard<std::mutex> lock(mutex);
+        insert(path, file);
+        return file;
+    }
+
+    void invalidate(const std::string &path)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = index.find(path);
+        if (it != index.end()) {
+            lru.erase(it->second);
+            index.erase(it);
+        }
+    }
+
+    void clear()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        index.clear();
+        lru.clear();
+    }
+
+    size_t size()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return lru.size();
+    }
+
+    size_t get_capacity() const {return capacity;}
+};
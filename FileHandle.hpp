@@ -1,13 +1,25 @@
 #pragma once
 #include <string>
 #include <algorithm>
+#include <memory> // for std::unique_ptr
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
 #ifdef _WIN32
 #define WIN32_LEAN_AND_MEAN
 #include <windows.h>
 #else
 #include <fcntl.h> // for `open()`
 #include <unistd.h> // for `read()`
+#include <stdio.h> // for `rename()`
+#include <string.h> // for `memchr()`
+#include <errno.h>
 #include <sys/stat.h>
+#ifdef __linux__
+#include <sys/sendfile.h>
+#include <sys/sysmacros.h> // for `makedev()`
+#endif
 #if __has_include (<sys/syscall.h>) && __has_include (<linux/stat.h>) // for `statx`
     // [https://github.com/boostorg/filesystem/blob/master/config/has_statx_syscall.cpp]
     #include <sys/syscall.h> // for __NR_statx
@@ -17,6 +29,7 @@
 #include "utf.hpp"
 #include "UnixNanotime.hpp"
 #include "UniqueHandle.hpp"
+#include "Checksum.hpp"
 
 #ifdef __GNUC__
 #define NOINLINE __attribute__((noinline))
@@ -42,6 +55,153 @@ class StatXFailed {};
 class AttemptToGetFileSizeOfAClosedFile {};
 class SeekFailed {};
 class SetLastWriteTimeFailed {};
+class SyncFailed {};
+class AtomicReplaceFailed {};
+class DirectoryOpenError {};
+
+enum class Durability
+{
+    none,          // data is made durable only by explicit `sync()` calls
+    sync_on_flush, // `OFile::flush()` makes written data durable
+    group_commit,  // concurrent `sync()` calls within a time or byte window share a single `fdatasync()`
+};
+
+struct FileInfo
+{
+    int64_t size = -1; // -2 if the file is not a regular file
+    UnixNanotime last_write_time = UnixNanotime::uninitialized(),
+                   creation_time = UnixNanotime::uninitialized(); // stays uninitialized if the creation time is not supported by the OS or the file system
+    uint64_t inode = 0, device = 0; // on Windows: file index and volume serial number
+    uint32_t block_size = 0; // preferred block size for I/O [0 if unknown]
+    uint64_t allocated_blocks = 0; // number of allocated 512-byte blocks
+};
+
+struct CommitStats
+{
+    uint64_t syncs = 0;   // number of `sync()` calls
+    uint64_t commits = 0; // number of `fdatasync()` calls (less than `syncs` when group commit is used)
+    std::chrono::nanoseconds last_latency{0}, max_latency{0}, total_latency{0}; // latency of `fdatasync()` calls
+};
+
+namespace detail
+{
+#ifndef _WIN32
+// Converts a UTF-16 file name to UTF-8 in a stack buffer [without memory allocation, unless the name is very long] and calls `f(const char *name)`
+template <class Func> auto with_str8_name(const char16_t *s, size_t len, Func &&f) -> decltype(f(""))
+{
+    char buf[1024];
+    if (len * 3 >= sizeof(buf)) // a UTF-16 code unit takes at most 3 bytes in UTF-8
+        return f(utf::as_str8(utf::std::u16string_view(s, len)).c_str());
+
+    uint8_t *p = (uint8_t*)buf;
+    for (const char16_t *source = s, *end = s + len; source < end;) {
+        bool ok;
+        char32_t ch = utf::decode(source, end, ok);
+        if (!ok) { // `utf::as_str8()` returns an empty string in this case
+            p = (uint8_t*)buf;
+            break;
+        }
+        p += utf::encode(ch, p);
+    }
+    *p = 0;
+    return f((const char*)buf);
+}
+template <class Func> auto with_str8_name(const char16_t *s, Func &&f) -> decltype(f(""))
+{
+    return with_str8_name(s, std::char_traits<char16_t>::length(s), std::forward<Func>(f));
+}
+#endif
+}
+
+/*
+A handle of an opened directory, which allows opening files relative to it [via `openat()`], so that the kernel does not resolve the whole path each time:
+    Directory dir("/data/shards");
+    IFile f(dir, "part-00000");
+*/
+class Directory
+{
+public:
+#ifdef _WIN32
+    std::u16string path; // Win32 API has no `openat()`, so files are opened by the directory path joined with the relative name
+
+    Directory() {}
+    Directory(const char16_t *s) {if (!open(s)) throw DirectoryOpenError();}
+    Directory(const char *s) : Directory(utf::as_u16(s).c_str()) {}
+    Directory(const Directory &dir, const char16_t *name) {if (!open(dir, name)) throw DirectoryOpenError();}
+    Directory(const Directory &dir, const char *name) : Directory(dir, utf::as_u16(name).c_str()) {}
+
+    bool open(const char16_t *s)
+    {
+        if (!path.empty())
+            throw FileIsAlreadyOpened();
+
+        DWORD attrs = GetFileAttributesW((wchar_t*)s);
+        if (attrs == INVALID_FILE_ATTRIBUTES || !(attrs & FILE_ATTRIBUTE_DIRECTORY))
+            return false;
+        path = s;
+        if (path.back() != u'\\' && path.back() != u'/')
+            path += u'\\';
+        return true;
+    }
+    bool open(const char *s) {return open(utf::as_u16(s).c_str());}
+    bool open(const Directory &dir, const char16_t *name) {return open((dir.path + name).c_str());}
+    bool open(const Directory &dir, const char *name) {return open(dir, utf::as_u16(name).c_str());}
+
+    bool is_valid() const {return !path.empty();}
+
+    void close() {path.clear();}
+#else
+    UniqueHandle<int, -1> fd;
+
+    Directory() {}
+    Directory(const char *s) {if (!open(s)) throw DirectoryOpenError();}
+    Directory(const char16_t *s) {if (!open(s)) throw DirectoryOpenError();}
+    Directory(const Directory &dir, const char *name) {if (!open(dir, name)) throw DirectoryOpenError();}
+    Directory(const Directory &dir, const char16_t *name) {if (!open(dir, name)) throw DirectoryOpenError();}
+
+    bool open(const char *s) {return open_at(AT_FDCWD, s);}
+    bool open(const char16_t *s) {return detail::with_str8_name(s, [this](const char *name) {return open_at(AT_FDCWD, name);});}
+    bool open(const Directory &dir, const char *name) {return open_at(dir.fd, name);}
+    bool open(const Directory &dir, const char16_t *name) {return detail::with_str8_name(name, [&](const char *n) {return open_at(dir.fd, n);});}
+
+    bool is_valid() const {return fd != -1;}
+
+    void close()
+    {
+        if (fd != -1) {
+            ::close(fd);
+            fd = -1;
+        }
+    }
+
+private:
+    bool open_at(int dir_fd, const char *name)
+    {
+        if (fd != -1)
+            throw FileIsAlreadyOpened();
+
+        fd = openat(dir_fd, name, O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+        return fd != -1;
+    }
+public:
+#endif
+    Directory(const std::string    &s) : Directory(s.c_str()) {}
+    Directory(const std::u16string &s) : Directory(s.c_str()) {}
+    Directory(const Directory &dir, const std::string    &name) : Directory(dir, name.c_str()) {}
+    Directory(const Directory &dir, const std::u16string &name) : Directory(dir, name.c_str()) {}
+#if !defined(_MSC_VER) || _MSC_VER > 1800
+    Directory(Directory &&) = default;
+#else
+    Directory(Directory &&d) : path(std::move(d.path)) {}
+#endif
+    Directory &operator=(Directory &&d)
+    {
+        move_assign(this, std::move(d));
+        return *this;
+    }
+
+    ~Directory() {close();}
+};
 
 namespace detail
 {
@@ -57,6 +217,110 @@ inline int stderr_handle() {return STDERR_FILENO;}
 typedef int HandleType;
 #endif
 
+#ifndef _WIN32
+enum class KernelCopy {copy_file_range, sendfile, splice, none}; // `splice()` is used when the input is a pipe
+
+// Copies up to `count` bytes from the current position of `in_fd` to the current position of `out_fd` without passing the data through user space.
+// Returns the number of bytes copied [0 at the end of input], or -1 if no method is supported for this pair of files [`method` is advanced to the first one that works].
+inline int64_t copy_in_kernel(int in_fd, int out_fd, size_t count, KernelCopy &method)
+{
+    count = (std::min)(count, (size_t)0x7ffff000);
+    while (true) {
+        int64_t r = -1;
+        errno = ENOSYS;
+        switch (method) {
+        case KernelCopy::copy_file_range: // can also make reflinks [on Btrfs, XFS] or do server-side copies [on NFS]
+#if defined(__linux__) && defined(__NR_copy_file_range) // avoid direct use of `copy_file_range()` [appeared in glibc 2.27]
+            r = syscall(__NR_copy_file_range, in_fd, NULL, out_fd, NULL, count, 0u);
+#endif
+            break;
+        case KernelCopy::sendfile:
+#ifdef __linux__
+            r = ::sendfile(out_fd, in_fd, NULL, count);
+#endif
+            break;
+        case KernelCopy::splice:
+#ifdef __linux__
+            r = ::splice(in_fd, NULL, out_fd, NULL, count, SPLICE_F_MOVE);
+#endif
+            break;
+        case KernelCopy::none:
+            return -1;
+        }
+        if (r >= 0)
+            return r;
+        if (errno == EINTR)
+            continue;
+        if (errno == EINVAL || errno == EXDEV || errno == ENOSYS || errno == EOPNOTSUPP || errno == EBADF || errno == EPERM) { // this method is not supported for these files, so try the next one
+            method = method == KernelCopy::copy_file_range ? KernelCopy::sendfile : KernelCopy::none;
+            continue;
+        }
+        throw IOError();
+    }
+}
+
+#ifdef __linux__
+// Copies data from the pipe `in_fd` to `out_fd` up to and including the first `delim` [which is written only if `keep_delim` is true].
+// The data is duplicated into a scratch pipe via `tee()` and read from it only to find `delim`, and is moved to `out_fd` via `splice()`, so it is not copied
+// to user space on the way to `out_fd`. Returns the number of bytes consumed from `in_fd`, or -1 if nothing has been consumed because `tee()`/`splice()`
+// are not supported for these files.
+inline int64_t copy_until_in_kernel(int in_fd, int out_fd, char delim, bool keep_delim, int64_t &written)
+{
+    const size_t CHUNK_SIZE = 64*1024; // the default pipe capacity, so that `tee()` never blocks on the scratch pipe
+    int scratch[2];
+    if (pipe2(scratch, O_CLOEXEC) != 0)
+        return -1;
+    struct ScratchPipe {int *fds; ~ScratchPipe() {::close(fds[0]); ::close(fds[1]);}} scratch_pipe = {scratch};
+    std::unique_ptr<char[]> buf(new char[CHUNK_SIZE]);
+
+    int64_t consumed = 0;
+    written = 0;
+    while (true) {
+        ssize_t t = tee(in_fd, scratch[1], CHUNK_SIZE, 0);
+        if (t == -1) {
+            if (errno == EINTR)
+                continue;
+            if (consumed == 0 && (errno == EINVAL || errno == ENOSYS))
+                return -1;
+            throw IOError();
+        }
+        if (t == 0) // end of input
+            return consumed;
+
+        for (ssize_t n = 0; n < t;) {
+            ssize_t r = ::read(scratch[0], buf.get() + n, t - n);
+            if (r <= 0)
+                throw IOError();
+            n += r;
+        }
+        const char *p = (const char*)memchr(buf.get(), delim, t);
+        size_t k = p != nullptr ? p - buf.get() + 1 : t;
+        size_t to_write = p != nullptr && !keep_delim ? k - 1 : k;
+
+        for (size_t n = 0; n < to_write;) {
+            ssize_t r = ::splice(in_fd, NULL, out_fd, NULL, to_write - n, SPLICE_F_MOVE);
+            if (r == -1 && errno == EINTR)
+                continue;
+            if (r == -1 && errno == EINVAL && consumed == 0 && n == 0) // e.g. `out_fd` is opened in append mode
+                return -1;
+            if (r <= 0)
+                throw IOError();
+            n += r;
+        }
+        if (to_write < k) { // skip the delimiter
+            char c;
+            if (::read(in_fd, &c, 1) != 1)
+                throw IOError();
+        }
+        consumed += k;
+        written += to_write;
+        if (p != nullptr)
+            return consumed;
+    }
+}
+#endif
+#endif
+
 template <bool for_reading> bool is_std_handle(HandleType);
 template <> inline bool is_std_handle<true> (HandleType handle) {return handle ==  stdin_handle();}
 template <> inline bool is_std_handle<false>(HandleType handle) {return handle == stdout_handle() || handle == stderr_handle();}
@@ -71,6 +335,15 @@ public:
     bool  open(const std::string    &s, bool append = false) {return open(s.c_str(), s.length(), append);}
     bool  open(const std::u16string &s, bool append = false) {return open(s.c_str(), s.length(), append);}
 
+    // Opening of files relative to a directory
+    FileHandle(const Directory &dir, const char     *name, bool append = false) {if (!open(dir, name, append)) throw FileOpenError();}
+    FileHandle(const Directory &dir, const char16_t *name, bool append = false) {if (!open(dir, name, append)) throw FileOpenError();}
+    FileHandle(const Directory &dir, const std::string    &name, bool append = false) : FileHandle(dir, name.c_str(), append) {}
+    FileHandle(const Directory &dir, const std::u16string &name, bool append = false) : FileHandle(dir, name.c_str(), append) {}
+
+    bool open(const Directory &dir, const std::string    &name, bool append = false) {return open(dir, name.c_str(), append);}
+    bool open(const Directory &dir, const std::u16string &name, bool append = false) {return open(dir, name.c_str(), append);}
+
 #ifdef _WIN32
     UniqueHandle<HANDLE, INVALID_HANDLE_VALUE> handle;
 
@@ -90,6 +363,8 @@ public:
 
     bool open(const char *s, size_t len, bool append = false) {return open(utf::as_u16(utf::std::string_view(s, len)), append);}
     bool open(const char *s,             bool append = false) {return open(utf::as_u16(s), append);}
+    bool open(const Directory &dir, const char16_t *name, bool append = false) {return open((dir.path + name).c_str(), append);}
+    bool open(const Directory &dir, const char     *name, bool append = false) {return open((dir.path + utf::as_u16(name)).c_str(), append);}
     bool open(const char16_t *s, size_t len, bool append = false)
     {
         if (s[len] != 0)
@@ -119,6 +394,8 @@ public:
 
     bool is_associated_with_console() const {return GetFileType(handle) == FILE_TYPE_CHAR;} // >[https://learn.microsoft.com/en-us/cpp/c-runtime-library/reference/isatty]:‘is associated with a character device (a terminal, console, ...)’
 
+    bool is_pipe() const {return GetFileType(handle) == FILE_TYPE_PIPE;}
+
     bool is_valid() {return handle != INVALID_HANDLE_VALUE;}
 
 private:
@@ -149,31 +426,52 @@ public:
             throw AttemptToReadAClosedFile();
 
         if (sz <= 0xFFFFFFFFu) {
-            return ReadFileAtPos(buf, (DWORD)sz, pos);
+            return hashed(buf, ReadFileAtPos(buf, (DWORD)sz, pos), pos);
         }
         else {
             char *b = (char*)buf;
+            int64_t chunk_pos = pos;
             while (true) {
-                DWORD numberOfBytesRead = ReadFileAtPos(b, (DWORD)(std::min)(sz, (size_t)0xFFFF0000), pos);
-                pos = -1;
+                DWORD numberOfBytesRead = ReadFileAtPos(b, (DWORD)(std::min)(sz, (size_t)0xFFFF0000), chunk_pos);
+                chunk_pos = -1;
                 if (numberOfBytesRead == 0)
-                    return b - (char*)buf;
+                    return hashed(buf, b - (char*)buf, pos);
                 b += numberOfBytesRead;
                 sz -= numberOfBytesRead;
                 if (sz == 0)
-                    return b - (char*)buf;
+                    return hashed(buf, b - (char*)buf, pos);
             }
         }
     }
 
+    size_t read_at(void *buf, size_t sz, int64_t pos) // positional read, which may be called concurrently from several threads
+    {
+        if (handle == INVALID_HANDLE_VALUE)
+            throw AttemptToReadAClosedFile();
+
+        char *b = (char*)buf;
+        while (sz != 0) {
+            DWORD numberOfBytesRead = ReadFileAtPos(b, (DWORD)(std::min)(sz, (size_t)0xFFFF0000), pos);
+            if (numberOfBytesRead == 0)
+                break;
+            b += numberOfBytesRead;
+            sz -= numberOfBytesRead;
+            pos += numberOfBytesRead;
+        }
+        return b - (char*)buf;
+    }
+
     void write(const void *buf, size_t sz)
     {
         if (handle == INVALID_HANDLE_VALUE)
             throw AttemptToWriteAClosedFile();
+        if (checksum != nullptr)
+            checksum->update(buf, sz);
 
         DWORD numberOfBytesWritten;
         if (!WriteFile(handle, buf, (DWORD)sz, &numberOfBytesWritten, NULL) || numberOfBytesWritten != sz)
             throw IOError();
+        note_written(sz);
     }
 
     void seek(int64_t pos)
@@ -186,16 +484,109 @@ public:
             throw SeekFailed();
     }
 
+    bool reserve(int64_t size, bool /*keep_size*/ = false) // on Windows, the file size is never changed (allocated space beyond the end of file is released when the file is closed)
+    {
+        static_assert(!for_reading, "reserve() is only allowed when writing");
+
+        if (handle == INVALID_HANDLE_VALUE)
+            throw AttemptToWriteAClosedFile();
+
+        FILE_ALLOCATION_INFO fai;
+        fai.AllocationSize.QuadPart = size;
+        return SetFileInformationByHandle(handle, FileAllocationInfo, &fai, sizeof(fai)) != 0;
+    }
+
+private:
+    void sync_data()
+    {
+        if (!FlushFileBuffers(handle))
+            throw SyncFailed();
+    }
+public:
     bool is_std_handle() const {return detail::is_std_handle<for_reading>(handle);}
 
     void close()
     {
         if (is_std_handle())
             handle = INVALID_HANDLE_VALUE;
+        if (handle != INVALID_HANDLE_VALUE) {
+            if (!atomic_replace_target.empty()) {
+                commit_atomic_replace();
+                return;
+            }
+            CloseHandle(handle);
+            handle = INVALID_HANDLE_VALUE;
+        }
+    }
+
+    // Atomic replacement
+private:
+    std::u16string atomic_replace_target, atomic_replace_temp;
+
+    void commit_atomic_replace()
+    {
+        try {
+            if (pending_last_write_time != UnixNanotime::uninitialized())
+                set_last_write_time(pending_last_write_time); // reapply, as writes made after `set_last_write_time()` have changed it
+            if (durability == Durability::group_commit || has_unsynced_data)
+                sync_data(); // the data must reach the disk before the rename, otherwise a crash may leave an empty target file
+        }
+        catch (...) {
+            discard();
+            throw;
+        }
+        CloseHandle(handle);
+        handle = INVALID_HANDLE_VALUE;
+        pending_last_write_time = UnixNanotime::uninitialized();
+
+        std::u16string target = std::move(atomic_replace_target), temp = std::move(atomic_replace_temp);
+        atomic_replace_target.clear();
+        atomic_replace_temp.clear();
+        if (!MoveFileExW((wchar_t*)temp.c_str(), (wchar_t*)target.c_str(), MOVEFILE_REPLACE_EXISTING | (durability != Durability::none ? MOVEFILE_WRITE_THROUGH : 0))) {
+            DeleteFileW((wchar_t*)temp.c_str());
+            throw AtomicReplaceFailed();
+        }
+    }
+
+public:
+    // Opens a temporary file next to `s`, which replaces `s` atomically on `close()` [so that a crash never leaves a partially written file];
+    // if the handle is destroyed without `close()`, the temporary file is discarded.
+    bool open_atomic_replace(const char16_t *s)
+    {
+        static_assert(!for_reading, "open_atomic_replace() is only allowed when writing");
+
+        if (handle != INVALID_HANDLE_VALUE)
+            throw FileIsAlreadyOpened();
+
+        static std::atomic<unsigned> counter{0};
+        std::u16string target(s);
+        for (int attempt = 0; attempt < 100; attempt++) {
+            std::string suffix = ".tmp" + std::to_string(GetCurrentProcessId()) + "." + std::to_string(counter++);
+            atomic_replace_temp = target + std::u16string(suffix.begin(), suffix.end());
+            handle = CreateFileW((wchar_t*)atomic_replace_temp.c_str(), GENERIC_WRITE, 0, NULL, CREATE_NEW, FILE_ATTRIBUTE_NORMAL, NULL);
+            if (handle != INVALID_HANDLE_VALUE || GetLastError() != ERROR_FILE_EXISTS)
+                break;
+        }
+        if (handle == INVALID_HANDLE_VALUE) {
+            atomic_replace_temp.clear();
+            return false;
+        }
+        atomic_replace_target = std::move(target);
+        return true;
+    }
+    bool open_atomic_replace(const char *s) {return open_atomic_replace(utf::as_u16(s).c_str());}
+
+    void discard() // closes the file opened by `open_atomic_replace()` without replacing the target file
+    {
         if (handle != INVALID_HANDLE_VALUE) {
             CloseHandle(handle);
             handle = INVALID_HANDLE_VALUE;
         }
+        if (!atomic_replace_temp.empty())
+            DeleteFileW((wchar_t*)atomic_replace_temp.c_str());
+        atomic_replace_target.clear();
+        atomic_replace_temp.clear();
+        pending_last_write_time = UnixNanotime::uninitialized();
     }
 #else
     UniqueHandle<int, -1> fd;
@@ -203,8 +594,8 @@ public:
     FileHandle() {}
     FileHandle(const char *s, bool append = false) {if (!open(s, append)) throw FileOpenError();}
     FileHandle(const char *s, size_t len, bool append = false) {if (!open(s, len, append)) throw FileOpenError();}
-    FileHandle(const char16_t *s, bool append = false) : FileHandle(utf::as_str8(s), append) {}
-    FileHandle(const char16_t *s, size_t len, bool append = false) : FileHandle(utf::as_str8(utf::std::u16string_view(s, len)), append) {}
+    FileHandle(const char16_t *s, bool append = false) {if (!open(s, append)) throw FileOpenError();}
+    FileHandle(const char16_t *s, size_t len, bool append = false) {if (!open(s, len, append)) throw FileOpenError();}
 
     void assign_std_handle(int d)
     {
@@ -214,8 +605,8 @@ public:
     }
     void assign_std_handle(const FileHandle &fh) {assign_std_handle(fh.fd);}
 
-    bool open(const char16_t *s, size_t len, bool append = false) {return open(utf::as_str8(utf::std::u16string_view(s, len)), append);}
-    bool open(const char16_t *s,             bool append = false) {return open(utf::as_str8(s), append);}
+    bool open(const char16_t *s, size_t len, bool append = false) {return with_str8_name(s, len, [&](const char *name) {return open(name, append);});}
+    bool open(const char16_t *s,             bool append = false) {return with_str8_name(s,      [&](const char *name) {return open(name, append);});}
     bool open(const char *s, size_t len, bool append = false)
     {
         if (s[len] != 0)
@@ -223,20 +614,32 @@ public:
         return open(s, append);
     }
 
-    bool open(const char *s, bool append = false)
+    bool open(const char *s, bool append = false) {return open_at(AT_FDCWD, s, append);}
+    bool open(const Directory &dir, const char     *name, bool append = false) {return open_at(dir.fd, name, append);}
+    bool open(const Directory &dir, const char16_t *name, bool append = false) {return with_str8_name(name, [&](const char *n) {return open_at(dir.fd, n, append);});}
+
+private:
+    bool open_at(int dir_fd, const char *s, bool append)
     {
         if (fd != -1)
             throw FileIsAlreadyOpened();
 
         if (for_reading)
-            fd = ::open(s, O_RDONLY);
+            fd = openat(dir_fd, s, O_RDONLY);
         else
-            fd = ::open(s, O_WRONLY|O_CREAT|(append ? O_APPEND : O_TRUNC), 0666);
+            fd = openat(dir_fd, s, O_WRONLY|O_CREAT|(append ? O_APPEND : O_TRUNC), 0666);
         return fd != -1;
     }
+public:
 
     bool is_associated_with_console() const {return isatty(fd) != 0;}
 
+    bool is_pipe() const
+    {
+        struct stat st;
+        return fstat(fd, &st) == 0 && S_ISFIFO(st.st_mode);
+    }
+
     bool is_valid() {return fd != -1;}
 
     size_t read(void *buf, size_t sz, int64_t pos = -1)
@@ -254,18 +657,42 @@ public:
             if (r == -1)
                 throw IOError();
             if (r == 0)
-                return b - (char*)buf;
+                return hashed(buf, b - (char*)buf, pos);
             b += r;
             sz -= r;
             if (sz == 0)
-                return b - (char*)buf;
+                return hashed(buf, b - (char*)buf, pos);
+        }
+    }
+
+    size_t read_at(void *buf, size_t sz, int64_t pos) // positional read [via `pread()`], which does not move the file pointer and may be called concurrently from several threads
+    {
+        if (fd == -1)
+            throw AttemptToReadAClosedFile();
+
+        char *b = (char*)buf;
+        while (sz != 0) {
+            ssize_t r = ::pread(fd, b, std::min(sz, (size_t)0x7ffff000), pos);
+            if (r == -1) {
+                if (errno == EINTR)
+                    continue;
+                throw IOError();
+            }
+            if (r == 0)
+                break;
+            b += r;
+            sz -= r;
+            pos += r;
         }
+        return b - (char*)buf;
     }
 
     void write(const void *buf, size_t sz)
     {
         if (fd == -1)
             throw AttemptToWriteAClosedFile();
+        if (checksum != nullptr)
+            checksum->update(buf, sz);
 
         char *b = (char*)buf;
         while (sz != 0) {
@@ -275,16 +702,107 @@ public:
             b += r;
             sz -= r;
         }
+        note_written(b - (char*)buf);
     }
 
+private:
+    int64_t reserved_size = 0, data_end = 0; // `reserved_size` is the file size set by `reserve()` [0 if it was not changed]; `data_end` is the end of written
+                                             // data before the last `seek()` [it is tracked only when the size has been changed]
+    bool has_reserved_blocks = false; // `reserve()` with `keep_size` has allocated blocks past the end of the file [not tracked in append mode]
+
+    void release_unused_reserved_space() // errors are ignored as in `close()`
+    {
+        if (reserved_size != 0) {
+            int64_t end = (std::max)(data_end, (int64_t)lseek(fd, 0, SEEK_CUR));
+            if (end >= 0 && end < reserved_size)
+                if (ftruncate(fd, end) != 0) {}
+        }
+        else { // the size has not been changed, so only the blocks past the end are released [truncation to the same size frees them on ext4 and XFS]
+            struct stat st;
+            if (fstat(fd, &st) == 0 && st.st_blksize > 0 && int64_t(st.st_blocks) * 512 > (st.st_size + st.st_blksize - 1) / st.st_blksize * st.st_blksize)
+                if (ftruncate(fd, st.st_size) != 0) {}
+        }
+        reserved_size = data_end = 0;
+        has_reserved_blocks = false;
+    }
+public:
     void seek(int64_t pos)
     {
         static_assert(!for_reading, "seek() is only allowed when writing");
 
+        if (reserved_size != 0)
+            data_end = (std::max)(data_end, (int64_t)lseek(fd, 0, SEEK_CUR));
+
         if (lseek(fd, pos, SEEK_SET) != pos)
             throw SeekFailed();
     }
 
+    // Allocates disk space for a file of `size` bytes in advance, so that it is laid out contiguously and its size is not updated on each `write()`.
+    // If `keep_size` is false, the file size is changed to `size` until `close()`, which truncates the file to the actual size of the written data;
+    // otherwise `close()` releases the blocks allocated past the end of the file [except in append mode].
+    bool reserve(int64_t size, bool keep_size = false)
+    {
+        static_assert(!for_reading, "reserve() is only allowed when writing");
+
+        if (fd == -1)
+            throw AttemptToWriteAClosedFile();
+#ifdef __linux__
+        bool append = (fcntl(fd, F_GETFL) & O_APPEND) != 0;
+        if (append) // in append mode data is always written at the end of the file, so its size must not be changed
+            keep_size = true;
+        if (fallocate(fd, keep_size ? FALLOC_FL_KEEP_SIZE : 0, 0, size) != 0)
+            return false;
+        if (!keep_size)
+            reserved_size = (std::max)(reserved_size, size);
+        else if (!append) // the blocks of an `O_APPEND` file are not released, as other writers may append to it concurrently with `close()`
+            has_reserved_blocks = true;
+        return true;
+#else
+        (void)size, (void)keep_size;
+        return false;
+#endif
+    }
+
+private:
+    void sync_data()
+    {
+#ifdef __APPLE__ // macOS does not have `fdatasync()`
+        if (fsync(fd) != 0)
+#else
+        if (fdatasync(fd) != 0)
+#endif
+            throw SyncFailed();
+    }
+public:
+    int64_t copy_from(FileHandle<true> &in, size_t count, KernelCopy &method) // see `copy_in_kernel()`
+    {
+        static_assert(!for_reading, "copy_from() is only allowed when writing");
+
+        if (fd == -1)
+            throw AttemptToWriteAClosedFile();
+
+        int64_t r = copy_in_kernel(in.fd, fd, count, method);
+        if (r > 0)
+            note_written((size_t)r);
+        return r;
+    }
+
+#ifdef __linux__
+    int64_t copy_until_from(FileHandle<true> &in, char delim, bool keep_delim) // see `copy_until_in_kernel()`
+    {
+        static_assert(!for_reading, "copy_until_from() is only allowed when writing");
+
+        if (fd == -1)
+            throw AttemptToWriteAClosedFile();
+
+        int64_t written;
+        int64_t r = copy_until_in_kernel(in.fd, fd, delim, keep_delim, written);
+        if (r > 0)
+            note_written((size_t)written);
+        return r;
+    }
+#endif
+
     bool is_std_handle() const {return detail::is_std_handle<for_reading>(fd);}
 
     void close()
@@ -292,15 +810,181 @@ public:
         if (is_std_handle())
             fd = -1;
         if (fd != -1) {
+            if (reserved_size != 0 || has_reserved_blocks)
+                release_unused_reserved_space();
+            if (!atomic_replace_target.empty()) {
+                commit_atomic_replace();
+                return;
+            }
             ::close(fd);
             fd = -1;
         }
     }
+
+    // Atomic replacement
+private:
+    std::string atomic_replace_target, atomic_replace_temp; // `atomic_replace_temp` is empty while an anonymous `O_TMPFILE` file is used
+
+    static std::string dir_name(const std::string &path)
+    {
+        size_t slash = path.rfind('/');
+        return slash == std::string::npos ? std::string(".") : slash == 0 ? std::string("/") : path.substr(0, slash);
+    }
+
+    template <class Create> static bool create_temp_name(const std::string &target, std::string &temp, Create &&create)
+    {
+        static std::atomic<unsigned> counter{0};
+        for (int attempt = 0; attempt < 100; attempt++) {
+            temp = target + ".tmp" + std::to_string(getpid()) + "." + std::to_string(counter++);
+            if (create(temp.c_str()))
+                return true;
+            if (errno != EEXIST)
+                break;
+        }
+        temp.clear();
+        return false;
+    }
+
+    static void copy_owner_and_mode(int from_fd, int to_fd) // errors are ignored [e.g. only root can give a file to another user, but the group may still be set]
+    {
+        struct stat st;
+        if (fstat(from_fd, &st) != 0)
+            return;
+        if (fchown(to_fd, st.st_uid, st.st_gid) != 0 && fchown(to_fd, (uid_t)-1, st.st_gid) != 0) {}
+        if (fchmod(to_fd, st.st_mode & 07777) != 0) {} // after `fchown()`, which may clear the set-user-ID and set-group-ID bits
+    }
+
+    void name_anonymous_temp() // gives the anonymous `O_TMPFILE` file a name next to the target
+    {
+        // `linkat()` cannot replace an existing file, so the file is linked under a temporary name [and then renamed]
+        std::string proc_path = "/proc/self/fd/" + std::to_string((int)fd);
+        if (create_temp_name(atomic_replace_target, atomic_replace_temp, [&proc_path](const char *temp) {
+                return linkat(AT_FDCWD, proc_path.c_str(), AT_FDCWD, temp, AT_SYMLINK_FOLLOW) == 0;
+            }))
+            return;
+
+        // `/proc` is not available [e.g. in a chroot or a sandbox], so the data is copied into a named temporary file
+        int named_fd = -1;
+        if (!create_temp_name(atomic_replace_target, atomic_replace_temp, [&named_fd](const char *temp) {
+                named_fd = ::open(temp, O_WRONLY|O_CREAT|O_EXCL|O_CLOEXEC, 0666);
+                return named_fd != -1;
+            }))
+            throw AtomicReplaceFailed();
+        copy_owner_and_mode(fd, named_fd);
+        std::unique_ptr<char[]> buf(new char[64*1024]);
+        for (off_t pos = 0;;) {
+            ssize_t r = pread(fd, buf.get(), 64*1024, pos);
+            if (r == -1 && errno == EINTR)
+                continue;
+            if (r <= 0) {
+                if (r == 0)
+                    break;
+                ::close(named_fd);
+                throw AtomicReplaceFailed(); // the named file is removed by `discard()`
+            }
+            for (ssize_t w = 0; w < r;) {
+                ssize_t n = ::write(named_fd, buf.get() + w, r - w);
+                if (n == -1 && errno != EINTR) {
+                    ::close(named_fd);
+                    throw AtomicReplaceFailed();
+                }
+                if (n > 0)
+                    w += n;
+            }
+            pos += r;
+        }
+        ::close(fd);
+        fd = named_fd;
+        has_unsynced_data = true;
+    }
+
+    void commit_atomic_replace()
+    {
+        try {
+            if (atomic_replace_temp.empty()) // give the anonymous file a name
+                name_anonymous_temp();
+            if (pending_last_write_time != UnixNanotime::uninitialized())
+                set_last_write_time(pending_last_write_time); // reapply, as writes made after `set_last_write_time()` have changed it
+            if (durability == Durability::group_commit || has_unsynced_data)
+                sync_data(); // the data must reach the disk before the rename, otherwise a crash may leave an empty target file
+
+            if (rename(atomic_replace_temp.c_str(), atomic_replace_target.c_str()) != 0)
+                throw AtomicReplaceFailed();
+        }
+        catch (...) {
+            discard();
+            throw;
+        }
+        ::close(fd);
+        fd = -1;
+        pending_last_write_time = UnixNanotime::uninitialized();
+
+        std::string target = std::move(atomic_replace_target);
+        atomic_replace_target.clear();
+        atomic_replace_temp.clear();
+        if (durability != Durability::none) { // make the rename itself durable
+            int dir_fd = ::open(dir_name(target).c_str(), O_RDONLY|O_DIRECTORY);
+            if (dir_fd == -1)
+                throw SyncFailed();
+            int r = fsync(dir_fd);
+            ::close(dir_fd);
+            if (r != 0)
+                throw SyncFailed();
+        }
+    }
+
+public:
+    // Opens a temporary file [an anonymous `O_TMPFILE` file if supported] in the directory of `s`, which replaces `s` atomically on `close()` [so that a crash
+    // never leaves a partially written file]. The data is always synced before the rename, and the directory is synced after it unless durability is `none`.
+    // The temporary file gets the owner and the permissions of `s`, if it exists. If the handle is destroyed without `close()` [e.g. when an exception
+    // unwinds the stack in the middle of writing], the temporary file is discarded and `s` is left untouched.
+    bool open_atomic_replace(const char *s)
+    {
+        static_assert(!for_reading, "open_atomic_replace() is only allowed when writing");
+
+        if (fd != -1)
+            throw FileIsAlreadyOpened();
+
+        std::string target(s);
+#ifdef O_TMPFILE
+        fd = ::open(dir_name(target).c_str(), O_TMPFILE|O_RDWR, 0666); // readable for the fallback in `name_anonymous_temp()`
+        if (fd == -1) // `O_TMPFILE` is not supported by this file system
 #endif
+        if (!create_temp_name(target, atomic_replace_temp, [this](const char *temp) {
+                fd = ::open(temp, O_WRONLY|O_CREAT|O_EXCL, 0666);
+                return fd != -1;
+            }))
+            return false;
+
+        int target_fd = ::open(target.c_str(), O_RDONLY|O_CLOEXEC|O_NONBLOCK);
+        if (target_fd != -1) {
+            copy_owner_and_mode(target_fd, fd);
+            ::close(target_fd);
+        }
+        atomic_replace_target = std::move(target);
+        return true;
+    }
+    bool open_atomic_replace(const char16_t *s) {return with_str8_name(s, [this](const char *name) {return open_atomic_replace(name);});}
+
+    void discard() // closes the file opened by `open_atomic_replace()` without replacing the target file
+    {
+        if (fd != -1) {
+            ::close(fd);
+            fd = -1;
+        }
+        if (!atomic_replace_temp.empty())
+            unlink(atomic_replace_temp.c_str());
+        atomic_replace_target.clear();
+        atomic_replace_temp.clear();
+        pending_last_write_time = UnixNanotime::uninitialized();
+    }
+#endif
+    bool open_atomic_replace(const std::string    &s) {return open_atomic_replace(s.c_str());}
+    bool open_atomic_replace(const std::u16string &s) {return open_atomic_replace(s.c_str());}
 #if !defined(_MSC_VER) || _MSC_VER > 1800
     FileHandle(FileHandle &&) = default;
 #else // unfortunately, MSVC 2013 doesn't support defaulted move constructors
-    FileHandle(FileHandle &&fh) : handle(std::move(fh.handle)), creation_time(fh.creation_time), last_write_time(fh.last_write_time), file_size(fh.file_size) {}
+    FileHandle(FileHandle &&fh) : handle(std::move(fh.handle)), checksum(fh.checksum), durability(fh.durability), group_commit(std::move(fh.group_commit)), commit_stats(fh.commit_stats), has_unsynced_data(fh.has_unsynced_data), atomic_replace_target(std::move(fh.atomic_replace_target)), atomic_replace_temp(std::move(fh.atomic_replace_temp)), creation_time(fh.creation_time), last_write_time(fh.last_write_time), pending_last_write_time(fh.pending_last_write_time), file_size(fh.file_size), file_info(fh.file_info), has_file_info(fh.has_file_info) {}
 #endif
     FileHandle &operator=(FileHandle &&fh)
     {
@@ -308,16 +992,192 @@ public:
         return *this;
     }
 
-    ~FileHandle() {close();}
+    ~FileHandle()
+    {
+        if (!atomic_replace_target.empty()) // only an explicit `close()` commits the replacement
+            discard();
+        else
+            close();
+    }
+
+    bool is_atomic_replace() const {return !atomic_replace_target.empty();} // true until the file opened by `open_atomic_replace()` is closed or discarded
+
+    // Checksum tap
+    Checksum *checksum = nullptr; // if set, all data passing through sequential `read()` [i.e. without an explicit position] and `write()` is hashed
+
+    size_t hashed(const void *buf, size_t sz, int64_t pos)
+    {
+        if (checksum != nullptr && pos == -1)
+            checksum->update(buf, sz);
+        return sz;
+    }
+
+    // Durability
+private:
+    struct GroupCommit
+    {
+        std::mutex mutex;
+        std::condition_variable cv;
+        uint64_t requested = 0, committed = 0; // `sync()` tickets
+        bool in_progress = false;
+        std::atomic<uint64_t> unsynced_bytes{0};
+        std::chrono::microseconds time_window;
+        uint64_t byte_window;
+    };
+    Durability durability = Durability::none;
+    std::unique_ptr<GroupCommit> group_commit;
+    CommitStats commit_stats;
+    bool has_unsynced_data = false; // not used in group commit mode
+
+    void note_written(size_t sz)
+    {
+        if (group_commit == nullptr)
+            has_unsynced_data = true;
+        else {
+            uint64_t prev = group_commit->unsynced_bytes.fetch_add(sz);
+            if (prev < group_commit->byte_window && prev + sz >= group_commit->byte_window) { // wake up the leader waiting for the window to be filled
+                std::lock_guard<std::mutex> lock(group_commit->mutex); // the leader checks the counter under the mutex, so the notification can not fall between its check and `wait_for()`
+                group_commit->cv.notify_all();
+            }
+        }
+    }
+
+    std::chrono::nanoseconds timed_sync_data()
+    {
+        auto start = std::chrono::steady_clock::now();
+        sync_data();
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+    }
+
+    void record_commit(std::chrono::nanoseconds latency)
+    {
+        commit_stats.commits++;
+        commit_stats.last_latency = latency;
+        commit_stats.max_latency = (std::max)(commit_stats.max_latency, latency);
+        commit_stats.total_latency += latency;
+    }
+
+public:
+    // In group commit mode, `sync()` calls made while an `fdatasync()` is running are served by a single following `fdatasync()`; if several of them are pending,
+    // the first one waits for up to `time_window` [or until `byte_window` bytes are written] for more threads to call `sync()`. A lone `sync()` never waits.
+    void set_durability(Durability d, std::chrono::microseconds time_window = std::chrono::microseconds(1000), uint64_t byte_window = 1024*1024)
+    {
+        static_assert(!for_reading, "set_durability() is only allowed when writing");
+
+        durability = d;
+        if (d == Durability::group_commit) {
+            group_commit.reset(new GroupCommit);
+            group_commit->time_window = time_window;
+            group_commit->byte_window = byte_window;
+        }
+        else
+            group_commit.reset();
+    }
+
+    Durability get_durability() const {return durability;}
+
+    bool has_data_to_sync() const {return has_unsynced_data;}
+
+    void sync() // makes all data written to the file durable [`fdatasync()`]; in group commit mode it is safe to call `sync()` concurrently with other `sync()` and `write()` calls
+    {
+        static_assert(!for_reading, "sync() is only allowed when writing");
+
+        if (!is_valid())
+            throw AttemptToWriteAClosedFile();
+
+        if (group_commit == nullptr) {
+            commit_stats.syncs++;
+            has_unsynced_data = false;
+            record_commit(timed_sync_data());
+            return;
+        }
+
+        GroupCommit &gc = *group_commit;
+        std::unique_lock<std::mutex> lock(gc.mutex);
+        commit_stats.syncs++;
+        uint64_t ticket = ++gc.requested;
+        while (gc.committed < ticket) {
+            if (gc.in_progress) { // another thread is the leader, so wait for its `fdatasync()` to complete
+                gc.cv.wait(lock);
+                continue;
+            }
+
+            // Become the leader and let other threads join the group [only if other threads are syncing too, so that a single writer does not wait]
+            gc.in_progress = true;
+            if (gc.requested - gc.committed > 1)
+                gc.cv.wait_for(lock, gc.time_window, [&gc]{return gc.unsynced_bytes >= gc.byte_window;});
+            uint64_t target = gc.requested; // all data written before `sync()` calls with these tickets will be made durable by the following `fdatasync()`
+            gc.unsynced_bytes = 0;
+            lock.unlock();
+
+            std::chrono::nanoseconds latency;
+            try {
+                latency = timed_sync_data();
+            }
+            catch (...) {
+                lock.lock();
+                gc.in_progress = false;
+                gc.cv.notify_all();
+                throw;
+            }
+
+            lock.lock();
+            gc.committed = (std::max)(gc.committed, target);
+            gc.in_progress = false;
+            record_commit(latency);
+            gc.cv.notify_all();
+        }
+    }
+
+    CommitStats get_commit_stats()
+    {
+        if (group_commit != nullptr) {
+            std::lock_guard<std::mutex> lock(group_commit->mutex);
+            return commit_stats;
+        }
+        return commit_stats;
+    }
 
     // File times and file size
 private:
     UnixNanotime creation_time = UnixNanotime::uninitialized(),
-               last_write_time = UnixNanotime::uninitialized();
+               last_write_time = UnixNanotime::uninitialized(),
+       pending_last_write_time = UnixNanotime::uninitialized(); // used in atomic replacement mode
     int64_t file_size = -1;
+    FileInfo file_info;
+    bool has_file_info = false;
+
+    void update_cached_file_info()
+    {
+        file_size = file_info.size;
+        last_write_time = file_info.last_write_time;
+        creation_time = file_info.creation_time;
+        has_file_info = true;
+    }
 #ifdef _WIN32
     static const int64_t _1601_TO_1970 = 116444736000000000i64; // number of 100 nanosecond units from 1/1/1601 to 1/1/1970
 
+    void fetch_file_info()
+    {
+        if (!is_valid())
+            throw AttemptToGetTimeOfAClosedFile();
+
+        BY_HANDLE_FILE_INFORMATION fi;
+        if (GetFileInformationByHandle(handle, &fi) == 0)
+            throw GetFileTimeFailed();
+
+        uint64_t cfiletime = (uint64_t(fi.ftCreationTime.dwHighDateTime) << 32) | fi.ftCreationTime.dwLowDateTime,
+                 mfiletime = (uint64_t(fi.ftLastWriteTime.dwHighDateTime) << 32) | fi.ftLastWriteTime.dwLowDateTime;
+        file_info.creation_time   = UnixNanotime::from_nanotime_t(int64_t(cfiletime - _1601_TO_1970) * 100);
+        file_info.last_write_time = UnixNanotime::from_nanotime_t(int64_t(mfiletime - _1601_TO_1970) * 100);
+        file_info.size = GetFileType(handle) == FILE_TYPE_DISK && !(fi.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) ? int64_t((uint64_t(fi.nFileSizeHigh) << 32) | fi.nFileSizeLow) : -2;
+        file_info.inode = (uint64_t(fi.nFileIndexHigh) << 32) | fi.nFileIndexLow;
+        file_info.device = fi.dwVolumeSerialNumber;
+        FILE_STANDARD_INFO si;
+        file_info.allocated_blocks = GetFileInformationByHandleEx(handle, FileStandardInfo, &si, sizeof(si)) ? uint64_t(si.AllocationSize.QuadPart) / 512 : 0;
+        update_cached_file_info();
+    }
+
     void get_file_times()
     {
         if (!is_valid())
@@ -361,23 +1221,58 @@ public:
     {
         if (!is_valid())
             throw AttemptToSetTimeOfAClosedFile();
+        if (!atomic_replace_target.empty())
+            pending_last_write_time = t;
 
         uint64_t filetime = t.to_uint64<100, _1601_TO_1970>();
         if (SetFileTime(handle, NULL, NULL, (FILETIME*)&filetime) == 0)
             throw SetLastWriteTimeFailed();
     }
 #else
-    void get_last_write_time_and_file_size()
+#ifdef __NR_statx
+    bool fetch_file_info_via_statx() // returns false if `statx()` can not be used [then `fstat()` is tried]
+    {
+        struct statx st;
+        // Avoid direct use of `statx()` [appeared in Linux 4.11, glibc 2.28] to support Ubuntu 18.04 [Linux 4.15, glibc 2.27]
+        if (syscall(__NR_statx, (int)fd, "", AT_EMPTY_PATH, STATX_TYPE|STATX_SIZE|STATX_MTIME|STATX_BTIME|STATX_INO|STATX_BLOCKS, &st) != 0) {
+            if (errno == EBADF) // `fstat()` would fail too
+                throw StatXFailed();
+            return false; // not only `ENOSYS`: seccomp filters [e.g. of older container runtimes] reject unknown syscalls with `EPERM`
+        }
+
+        file_info.size = S_ISREG(st.stx_mode) ? (int64_t)st.stx_size : -2;
+        file_info.last_write_time = UnixNanotime::from_nanotime_t(st.stx_mtime.tv_sec * 1000000000 + st.stx_mtime.tv_nsec);
+        file_info.creation_time = st.stx_mask & STATX_BTIME ? UnixNanotime::from_nanotime_t(st.stx_btime.tv_sec * 1000000000 + st.stx_btime.tv_nsec) : UnixNanotime::uninitialized();
+        file_info.inode = st.stx_ino;
+        file_info.device = makedev(st.stx_dev_major, st.stx_dev_minor);
+        file_info.block_size = st.stx_blksize;
+        file_info.allocated_blocks = st.stx_blocks;
+        return true;
+    }
+#endif
+
+    void fetch_file_info() // fetches all metadata with a single syscall
     {
         if (!is_valid())
             throw AttemptToGetTimeOfAClosedFile();
 
-        struct stat st;
-        if (fstat(fd, &st) != 0)
-            throw FStatFailed();
+#ifdef __NR_statx
+        if (!fetch_file_info_via_statx())
+#endif
+        {
+            struct stat st;
+            if (fstat(fd, &st) != 0)
+                throw FStatFailed();
 
-        last_write_time = UnixNanotime::from_nanotime_t(st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec);
-        file_size = S_ISREG(st.st_mode) ? st.st_size : -2;
+            file_info.size = S_ISREG(st.st_mode) ? st.st_size : -2;
+            file_info.last_write_time = UnixNanotime::from_nanotime_t(st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec);
+            file_info.creation_time = UnixNanotime::uninitialized();
+            file_info.inode = st.st_ino;
+            file_info.device = st.st_dev;
+            file_info.block_size = st.st_blksize;
+            file_info.allocated_blocks = st.st_blocks;
+        }
+        update_cached_file_info();
     }
 
 public:
@@ -387,14 +1282,10 @@ public:
         throw GetCreationTimeIsNotSupported();
 #else
         if (creation_time == UnixNanotime::uninitialized()) {
-            if (!is_valid())
-                throw AttemptToGetTimeOfAClosedFile();
-
-            struct statx st;
-            // Avoid direct use of `statx()` [appeared in Linux 4.11, glibc 2.28] to support Ubuntu 18.04 [Linux 4.15, glibc 2.27]
-            if (syscall(__NR_statx, (int)fd, "", AT_EMPTY_PATH, STATX_BTIME, &st) != 0 || !(st.stx_mask & STATX_BTIME))
+            if (!has_file_info)
+                fetch_file_info();
+            if (creation_time == UnixNanotime::uninitialized())
                 throw StatXFailed();
-            creation_time = UnixNanotime::from_nanotime_t(st.stx_btime.tv_sec * 1000000000 + st.stx_btime.tv_nsec);
         }
         return creation_time;
 #endif
@@ -402,14 +1293,14 @@ public:
     UnixNanotime get_last_write_time()
     {
         if (last_write_time == UnixNanotime::uninitialized())
-            get_last_write_time_and_file_size();
+            fetch_file_info();
         return last_write_time;
     }
 
     int64_t get_file_size()
     {
         if (file_size == -1)
-            get_last_write_time_and_file_size();
+            fetch_file_info();
         return file_size;
     }
 
@@ -417,6 +1308,8 @@ public:
     {
         if (!is_valid())
             throw AttemptToSetTimeOfAClosedFile();
+        if (!atomic_replace_target.empty())
+            pending_last_write_time = t;
 
         timespec times[2];
         times[0].tv_nsec = UTIME_OMIT;
@@ -425,5 +1318,20 @@ public:
             throw SetLastWriteTimeFailed();
     }
 #endif
+
+    // Returns a snapshot of the file metadata, which is fetched with a single syscall on the first call and cached
+    // [`get_file_size()`, `get_last_write_time()` and `get_creation_time()` use the same cache]
+    const FileInfo &get_file_info()
+    {
+        if (!has_file_info)
+            fetch_file_info();
+        return file_info;
+    }
+
+    const FileInfo &refresh() // re-reads the file metadata
+    {
+        fetch_file_info();
+        return file_info;
+    }
 };
 }
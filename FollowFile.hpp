@@ -0,0 +1,204 @@
+#pragma once
+#include "IFile.hpp"
+#include <thread> // for `std::this_thread::sleep_for()`
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <poll.h>
+#endif
+
+/*
+Follow mode for a growing file [like `tail -F`]: when the reader reaches the end of the file, `read_line_follow()` and `wait_for_data()` block until new data
+is appended [woken by inotify on Linux, or by polling on other systems], and then reading continues. If the file is truncated, reading restarts from its beginning;
+if the file is replaced [e.g. by log rotation], the new file at the same path is opened after the rest of the old one has been read.
+Truncation is noticed when the file size drops below the read position, or when the last `TAIL_SIZE` bytes before the read position change [this catches
+`copytruncate` or `O_TRUNC` rewrites which have already grown past the old position]. A rewrite which reproduces these bytes exactly is not noticed:
+    FollowFile f("/var/log/app.log", true);
+    std::string line;
+    while (true)
+        if (f.read_line_follow(line))
+            ship(line);
+*/
+class FollowFile : public IFile
+{
+    std::string path;
+    std::string partial_line; // the beginning of a line which has not been terminated yet
+    bool partial_line_ended = false; // the file has been truncated or replaced, so `partial_line` will never be terminated and is returned as the last line of the old file
+    static const size_t TAIL_SIZE = 64;
+    std::string tail; // the bytes before `tail_pos`, which are remembered on reaching the end of the file to notice rewrites
+    int64_t tail_pos = -1;
+#ifdef __linux__
+    UniqueHandle<int, -1> inotify_fd;
+    std::string name; // the file name, which is compared with names in inotify events [the directory is watched, so that creation of a new file is noticed]
+#endif
+
+    typedef std::chrono::steady_clock Clock;
+
+    void remember_tail(int64_t pos)
+    {
+        tail.resize((size_t)(std::min)(pos, (int64_t)TAIL_SIZE));
+        tail.resize(fh.read_at(&tail[0], tail.size(), pos - tail.size()));
+        tail_pos = pos;
+    }
+
+    bool tail_changed(int64_t pos)
+    {
+        if (tail_pos != pos || tail.empty())
+            return false;
+        char buf[TAIL_SIZE];
+        return fh.read_at(buf, tail.size(), pos - tail.size()) != tail.size() || memcmp(buf, tail.data(), tail.size()) != 0;
+    }
+
+    // Checks the file after reaching its end; returns true if there is data to read
+    bool check_file()
+    {
+        if (!at_eof())
+            return true;
+
+        const FileInfo &fi = fh.refresh();
+        int64_t pos = tell();
+        if (fi.size < pos || (fi.size > pos && tail_changed(pos))) { // the file has been truncated [and possibly rewritten past the read position]
+            partial_line_ended = !partial_line.empty();
+            tail_pos = -1;
+            seek(0);
+            return partial_line_ended || !at_eof(); // the pending part of a line is returned without waiting for new data
+        }
+        if (fi.size > pos) { // new data has been appended
+            is_eof_reached = eof_indicator = false;
+            return !at_eof();
+        }
+        if (tail_pos != pos && fi.size >= 0)
+            remember_tail(pos);
+
+        // Check whether the file at the path has been replaced
+        detail::FileHandle<true> probe;
+        if (probe.open(path)) {
+            const FileInfo &pi = probe.get_file_info();
+            if (pi.inode != fi.inode || pi.device != fi.device) {
+                close();
+                partial_line_ended = !partial_line.empty();
+                tail_pos = -1;
+                fh = std::move(probe);
+                return partial_line_ended || !at_eof();
+            }
+        }
+        return false;
+    }
+
+    bool wait_for_change(std::chrono::milliseconds timeout) // returns true if the file may have changed [or the timeout has expired], and false on irrelevant inotify events
+    {
+        const std::chrono::milliseconds POLL_INTERVAL(100), MAX_INOTIFY_WAIT(1000); // inotify is not fully reliable [e.g. on network file systems], so the file is checked at least once per second
+#ifdef __linux__
+        if (inotify_fd != -1) {
+            pollfd pfd = {inotify_fd, POLLIN, 0};
+            if (::poll(&pfd, 1, (int)(std::min)(timeout, MAX_INOTIFY_WAIT).count()) <= 0)
+                return true;
+
+            // Drain all pending events and look for the events about the followed file
+            bool relevant = false;
+            alignas(inotify_event) char events[4096];
+            ssize_t n;
+            while ((n = ::read(inotify_fd, events, sizeof(events))) > 0)
+                for (char *p = events; p < events + n;) {
+                    const inotify_event *e = (const inotify_event*)p;
+                    if (e->len != 0 && name == e->name)
+                        relevant = true;
+                    p += sizeof(inotify_event) + e->len;
+                }
+            return relevant;
+        }
+#endif
+        std::this_thread::sleep_for((std::min)(timeout, POLL_INTERVAL));
+        return true;
+    }
+
+    static std::chrono::milliseconds remaining_time(Clock::time_point deadline, bool infinite)
+    {
+        if (infinite)
+            return std::chrono::milliseconds(INT32_MAX);
+        auto now = Clock::now();
+        return now < deadline ? std::chrono::duration_cast<std::chrono::milliseconds>(deadline - now + std::chrono::microseconds(999)) : std::chrono::milliseconds(0);
+    }
+
+public:
+    // If `from_end` is true, only the data appended after opening is read
+    FollowFile(const std::string &path, bool from_end = false) : IFile(path), path(path)
+    {
+        if (from_end)
+            seek(get_file_size());
+#ifdef __linux__
+        size_t slash = path.rfind('/');
+        std::string dir = slash == std::string::npos ? std::string(".") : slash == 0 ? std::string("/") : path.substr(0, slash);
+        name = path.substr(slash + 1);
+        inotify_fd = inotify_init1(IN_NONBLOCK|IN_CLOEXEC);
+        if (inotify_fd != -1 && inotify_add_watch(inotify_fd, dir.c_str(), IN_MODIFY|IN_CREATE|IN_MOVED_TO) == -1) { // fall back to polling
+            ::close(inotify_fd);
+            inotify_fd = -1;
+        }
+#endif
+    }
+
+    FollowFile(const FollowFile &) = delete;
+    void operator=(const FollowFile &) = delete;
+
+    ~FollowFile()
+    {
+#ifdef __linux__
+        if (inotify_fd != -1)
+            ::close(inotify_fd);
+#endif
+    }
+
+    // Blocks until there is data to read; returns false on timeout [a negative timeout means waiting forever]
+    bool wait_for_data(std::chrono::milliseconds timeout = std::chrono::milliseconds(-1))
+    {
+        bool infinite = timeout.count() < 0;
+        Clock::time_point deadline = Clock::now() + (infinite ? std::chrono::milliseconds(0) : timeout);
+        while (true) {
+            if (check_file())
+                return true;
+            std::chrono::milliseconds remaining;
+            do {
+                remaining = remaining_time(deadline, infinite);
+                if (remaining.count() == 0)
+                    return false;
+            } while (!wait_for_change(remaining));
+        }
+    }
+
+    // Reads the next complete line [i.e. terminated with "\n"], waiting for it if necessary; returns false on timeout
+    // [the part of the line which has been read already is kept, and returned by the next call after the line is completed;
+    // if the file is truncated or replaced before that, the unterminated part is returned as it is, before the lines of the new data]
+    bool read_line_follow(std::string &r, std::chrono::milliseconds timeout = std::chrono::milliseconds(-1), bool keep_newline = false)
+    {
+        bool infinite = timeout.count() < 0;
+        Clock::time_point deadline = Clock::now() + (infinite ? std::chrono::milliseconds(0) : timeout);
+        while (true) {
+            if (partial_line_ended) {
+                r = std::move(partial_line);
+                partial_line.clear();
+                partial_line_ended = false;
+                return true;
+            }
+            if (!at_eof()) {
+                read_until<false>(r, '\n', true);
+                partial_line += r;
+                if (partial_line.back() != '\n') // the line is not complete yet
+                    continue;
+
+                r = std::move(partial_line);
+                partial_line.clear();
+                if (!keep_newline) {
+                    r.pop_back();
+                    if (!r.empty() && r.back() == '\r')
+                        r.pop_back();
+                }
+                else
+                    if (r.length() >= 2 && r[r.length() - 2] == '\r')
+                        r.erase(r.length() - 2, 1);
+                return true;
+            }
+            if (!wait_for_data(remaining_time(deadline, infinite)))
+                return false;
+        }
+    }
+};
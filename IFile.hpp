@@ -1,16 +1,32 @@
 #pragma once
 #include <vector>
 #include <array>
+#include <unordered_map>
 #include <cstdint> // for uint8_t
 #include "FileHandle.hpp"
+#include "SubstringSearch.hpp"
 #include <memory> // for std::unique_ptr
+#include <exception> // for std::exception_ptr
+#include <future> // for `std::async()` in `count_lines()`
+#include <thread> // for `std::thread::hardware_concurrency()`
+#include <type_traits> // for `std::make_unsigned`
+#ifdef _MSC_VER
+#include <intrin.h> // for `_BitScanForward64()`
+#endif
 #include <string.h> // for memcmp and memchr [GCC]
 #ifndef assert
 #include <assert.h>
 #endif
+#ifdef __linux__
+#include <sys/mman.h> // for `mmap()` and `madvise()`
+#endif
 
 const size_t IFILE_DEFAULT_BUFFER_SIZE = 32*1024;
 const size_t IFILE_BUFFER_SIZE_RIGHT_AFTER_SEEK = 4*1024;
+const size_t IFILE_DIRECT_CHUNK_SIZE = 1024*1024; // the size of windows of `for_each_chunk()`, which are read bypassing the buffer
+const size_t IFILE_SMALL_FILE_SIZE = 8*1024; // files smaller than this are read by `read_text()`/`read_bytes()` into a stack buffer without `fstat()`
+const size_t IFILE_READ_TEXT_STEP_SIZE = 256*1024; // the step in which `read_text(std::string&)` grows the string [see the comment there]
+const size_t IFILE_LINE_COUNT_RANGE_SIZE = 16*1024*1024; // the minimum size of a range of a file counted by one thread in `count_lines(path)`
 
 class IFileBufferAlreadyAllocated {};
 class UnexpectedEOF {};
@@ -22,6 +38,204 @@ class FileIsTooLargeToFitInMemory {};
 class OSReportedIncorrectFileSize {};
 class FileSizeIsUnknown {};
 class FileDoesNotSupportPositioning {};
+class BlockSizeMustBeAPowerOfTwo {};
+class PeekSpanIsNotSupportedWithBlockCache {};
+class ConsumeBeyondPeekedSpan {};
+class CountOccurrencesOfAnEmptyString {};
+class VarintIsTooLong {};
+
+// A byte buffer with uninitialized storage [unlike `std::vector<uint8_t>(n)`, the memory is not zero-filled before the file data is read into it]
+class FileBuffer
+{
+    friend class IFile;
+    uint8_t *ptr = nullptr;
+    size_t sz = 0, capacity = 0;
+    bool mapped = false; // true if the memory was allocated via `mmap()`
+
+    void release()
+    {
+#ifdef __linux__
+        if (mapped) {
+            munmap(ptr, capacity);
+            return;
+        }
+#endif
+        delete[] ptr;
+    }
+
+public:
+    FileBuffer() {}
+
+    // If `huge_pages` is true, large buffers are backed by transparent huge pages [via `madvise(MADV_HUGEPAGE)`], which reduces TLB misses when the buffer is
+    // processed [this is supported on Linux only, as huge pages on Windows require the ‘Lock pages in memory’ privilege]
+    explicit FileBuffer(size_t size, bool huge_pages = false) : sz(size), capacity(size)
+    {
+#ifdef __linux__
+        const size_t HUGE_PAGE_SIZE = 2*1024*1024;
+        if (huge_pages && size >= HUGE_PAGE_SIZE) {
+            capacity = (size + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+            void *p = mmap(nullptr, capacity, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+            if (p == MAP_FAILED)
+                throw std::bad_alloc();
+            madvise(p, capacity, MADV_HUGEPAGE);
+            ptr = (uint8_t*)p;
+            mapped = true;
+            return;
+        }
+#else
+        (void)huge_pages;
+#endif
+        ptr = new uint8_t[size];
+    }
+
+    FileBuffer(FileBuffer &&b) : ptr(b.ptr), sz(b.sz), capacity(b.capacity), mapped(b.mapped)
+    {
+        b.ptr = nullptr;
+        b.sz = b.capacity = 0;
+        b.mapped = false;
+    }
+    FileBuffer &operator=(FileBuffer &&b)
+    {
+        move_assign(this, std::move(b));
+        return *this;
+    }
+    ~FileBuffer() {release();}
+
+          uint8_t *data()       {return ptr;}
+    const uint8_t *data() const {return ptr;}
+    size_t size() const {return sz;}
+    bool empty() const {return sz == 0;}
+
+          uint8_t *begin()       {return ptr;}
+    const uint8_t *begin() const {return ptr;}
+          uint8_t *end()       {return ptr + sz;}
+    const uint8_t *end() const {return ptr + sz;}
+
+          uint8_t &operator[](size_t i)       {return ptr[i];}
+    const uint8_t &operator[](size_t i) const {return ptr[i];}
+
+    utf::std::string_view as_string_view() const {return utf::std::string_view((const char*)ptr, sz);}
+};
+
+struct ByteSpan
+{
+    const uint8_t *data;
+    size_t size;
+
+    const uint8_t *begin() const {return data;}
+    const uint8_t *end()   const {return data + size;}
+};
+
+namespace detail
+{
+// Size-bounded cache of file blocks with CLOCK eviction [see `IFile::enable_block_cache()`]
+class BlockCache
+{
+    struct Slot
+    {
+        int64_t block_no = -1;
+        size_t size = 0;
+        bool referenced = false;
+    };
+    size_t block_size;
+    std::unique_ptr<uint8_t[]> storage; // `slots.size()` blocks of `block_size` bytes
+    std::vector<Slot> slots;
+    std::unordered_map<int64_t, size_t> index; // block number -> slot
+    size_t hand = 0;
+
+public:
+    BlockCache(size_t capacity, size_t block_size) : block_size(block_size), slots((std::max)(capacity / block_size, size_t(1)))
+    {
+        storage.reset(new uint8_t[slots.size() * block_size]);
+        index.reserve(slots.size());
+    }
+
+    const uint8_t *find(int64_t block_no, size_t &size)
+    {
+        auto it = index.find(block_no);
+        if (it == index.end())
+            return nullptr;
+        Slot &slot = slots[it->second];
+        slot.referenced = true;
+        size = slot.size;
+        return storage.get() + it->second * block_size;
+    }
+
+    void insert(int64_t block_no, const uint8_t *data, size_t size)
+    {
+        // Find a victim: the clock hand skips [and clears] slots which have been referenced since the last pass
+        while (slots[hand].referenced) {
+            slots[hand].referenced = false;
+            hand = (hand + 1) % slots.size();
+        }
+        Slot &slot = slots[hand];
+        if (slot.block_no != -1)
+            index.erase(slot.block_no);
+        slot.block_no = block_no;
+        slot.size = size;
+        memcpy(storage.get() + hand * block_size, data, size);
+        index.emplace(block_no, hand);
+        hand = (hand + 1) % slots.size();
+    }
+
+    void clear()
+    {
+        for (Slot &slot : slots)
+            slot = Slot();
+        index.clear();
+    }
+};
+
+inline int count_trailing_zeros64(uint64_t x) // `x` != 0
+{
+#ifdef _MSC_VER
+    unsigned long i;
+    _BitScanForward64(&i, x);
+    return (int)i;
+#else
+    return __builtin_ctzll(x);
+#endif
+}
+
+inline uint64_t compact_varint_groups(uint64_t x) // gathers the 7-bit groups of up to 8 bytes of a varint [pairs of groups into 14-bit lanes, then into 28-bit lanes, then into 56 bits]
+{
+    x &= 0x7F7F7F7F7F7F7F7FULL; // drop the continuation bits
+    x = (x & 0x007F007F007F007FULL) | ((x & 0x7F007F007F007F00ULL) >> 1);
+    x = (x & 0x00003FFF00003FFFULL) | ((x & 0x3FFF00003FFF0000ULL) >> 2);
+    return (x & 0x000000000FFFFFFFULL) | ((x & 0x0FFFFFFF00000000ULL) >> 4);
+}
+
+inline size_t decode_long_varint(const uint8_t *p, uint64_t x, uint64_t &v) // decodes a varint of 9 or 10 bytes [`x` holds the first 8 bytes]
+{
+    x = compact_varint_groups(x) | uint64_t(p[8] & 0x7F) << 56;
+    if (p[8] < 0x80) {
+        v = x;
+        return 9;
+    }
+    if (p[9] >= 0x80)
+        return 0;
+    v = x | uint64_t(p[9]) << 63;
+    return 10;
+}
+
+/*
+Decodes a varint [LEB128, as in protobuf] at `p`, which must have at least 10 readable bytes; returns the length of the varint, or 0 if it is longer than 10 bytes.
+Varints of up to 8 bytes are decoded without a loop: the end of the varint is found among the high bits of 8 loaded bytes, and then the 7-bit groups are gathered.
+*/
+inline size_t decode_varint(const uint8_t *p, uint64_t &v)
+{
+    if (p[0] < 0x80) { // the most common case is checked first [as the branch is well predicted for small values]
+        v = p[0];
+        return 1;
+    }
+    uint64_t x = read64(p);
+    uint64_t stop_bits = ~x & 0x8080808080808080ULL; // the high bit is clear in the last byte of a varint
+    if (stop_bits == 0)
+        return decode_long_varint(p, x, v);
+    v = compact_varint_groups(x & (stop_bits ^ (stop_bits - 1))); // the bytes after the varint are dropped
+    return count_trailing_zeros64(stop_bits) / 8 + 1;
+}
+}
 
 /*
 H‘Naming things is hard’
@@ -31,8 +245,13 @@ I thought of using `FileReader` or `BufferedFileReader`, but `FileReader` means
 There are `CInFile` and `COutFile` here[https://android.googlesource.com/platform/external/lzma/+/kitkat-dev/CPP/Windows/FileIO.h <- google:‘"class CInFile"’],
 so you can think of `IFile` and `OFile` as short forms of them.
 */
+class OFile;
+class MultiFileReader;
+
 class IFile
 {
+    friend class OFile; // for `OFile::write_from()`
+    friend class MultiFileReader; // for `contains_only_bom()`
 protected:
     detail::FileHandle<true> fh;
     std::unique_ptr<uint8_t[]> buffer;
@@ -40,6 +259,7 @@ protected:
     int64_t file_pos_of_buffer_start = 0;
     bool is_eof_reached = false;
     bool eof_indicator = false; // >[https://www.open-std.org/jtc1/sc22/wg14/www/docs/n3096.pdf <- https://en.wikipedia.org/wiki/C23_(C_standard_revision)]:‘The `feof` function tests the end-of-file indicator’
+    std::unique_ptr<detail::BlockCache> block_cache;
 
     void allocate_buffer()
     {
@@ -58,6 +278,18 @@ protected:
             return true;
         }
 
+        if (block_cache != nullptr) {
+            int64_t pos = file_pos_of_buffer_start + buffer_size;
+            if ((pos & (buffer_capacity - 1)) != 0) { // only the last block of the file is partial [`is_eof_reached` could have been reset by `seek()`]
+                file_pos_of_buffer_start = pos;
+                buffer_pos = buffer_size = 0;
+                is_eof_reached = true;
+                return true;
+            }
+            read_block(pos);
+            return buffer_size == 0;
+        }
+
         allocate_buffer();
 
         file_pos_of_buffer_start += buffer_size;
@@ -70,6 +302,55 @@ protected:
         return buffer_size == 0;
     }
 
+    void read_block(int64_t pos) // fills the buffer with the block at `pos` [a multiple of the block size] via the block cache
+    {
+        allocate_buffer();
+        file_pos_of_buffer_start = pos;
+        buffer_pos = 0;
+
+        int64_t block_no = pos / buffer_capacity;
+        if (const uint8_t *p = block_cache->find(block_no, buffer_size))
+            memcpy(buffer.get(), p, buffer_size);
+        else {
+            buffer_size = fh.read(buffer.get(), buffer_capacity, pos); // reading at an explicit position, as the file position of `fh` is not advanced on cache hits
+            if (buffer_size != 0)
+                block_cache->insert(block_no, buffer.get(), buffer_size);
+        }
+        is_eof_reached = buffer_size < buffer_capacity;
+    }
+
+    void load_block_before(int64_t pos) // makes the buffer contain the bytes right before `pos` [for backward reading]
+    {
+        if (pos > file_pos_of_buffer_start && pos <= file_pos_of_buffer_start + int64_t(buffer_size))
+            return;
+
+        if (block_cache != nullptr) {
+            read_block((pos - 1) & ~int64_t(buffer_capacity - 1));
+            return;
+        }
+
+        allocate_buffer();
+        int64_t start = (std::max)(pos - int64_t(buffer_capacity), int64_t(0));
+        buffer_size = fh.read(buffer.get(), size_t(pos - start), start); // the file position of `fh` is right after the buffer then, as forward reading expects
+        if (buffer_size != size_t(pos - start))
+            throw OSReportedIncorrectFileSize();
+        file_pos_of_buffer_start = start;
+        buffer_pos = 0;
+        is_eof_reached = false;
+    }
+
+    static const uint8_t *find_last(const uint8_t *begin, const uint8_t *end, uint8_t c)
+    {
+#ifdef _GNU_SOURCE
+        return (const uint8_t*)memrchr(begin, c, end - begin); // vectorized in glibc
+#else
+        while (end != begin)
+            if (*--end == c)
+                return end;
+        return nullptr;
+#endif
+    }
+
     static bool is_bom(const uint8_t *p)
     {
         uint8_t utf8bom[3] = {0xEF, 0xBB, 0xBF};
@@ -91,6 +372,36 @@ protected:
         return false;
     }
 
+    bool contains_only_bom() const // such a file is empty for text reading [see `skip_bom()`]
+    {
+        return file_pos_of_buffer_start == 0 && buffer_pos == 0 && buffer_size == 3 && is_eof_reached && is_bom(buffer.get());
+    }
+
+    // Small-file fast path of whole-file reads: reads optimistically into the caller's stack buffer `small` [of `IFILE_SMALL_FILE_SIZE` bytes],
+    // and returns true if the whole file fits in it, so that the file size is not requested [i.e. no `fstat()` syscall]
+    bool read_small_file(uint8_t *small, size_t &n)
+    {
+        n = fh.read(small, IFILE_SMALL_FILE_SIZE);
+        file_pos_of_buffer_start = n;
+        if (n < IFILE_SMALL_FILE_SIZE) {
+            is_eof_reached = true;
+            return true;
+        }
+        return false;
+    }
+
+    size_t rest_of_file_size(size_t n) // returns the number of bytes after the first `n` bytes which have been read by `read_small_file()`, or SIZE_MAX if the file size is unknown
+    {
+        int64_t file_size = fh.get_file_size();
+        if (file_size == -2)
+            return SIZE_MAX;
+        if (uint64_t(file_size) > SIZE_MAX)
+            throw FileIsTooLargeToFitInMemory();
+        if ((size_t)file_size < n)
+            throw OSReportedIncorrectFileSize();
+        return (size_t)file_size - n;
+    }
+
     static void handle_newlines(std::string &s)
     {
         // Replace all "\r\n" with "\n"
@@ -115,7 +426,7 @@ public:
     template <class... Args> IFile(Args&&... args) : fh(std::forward<Args>(args)...) {}
     template <class... Args> bool open(Args&&... args) {return fh.open(std::forward<Args>(args)...);}
 #if defined(_MSC_VER) && _MSC_VER <= 1800 // for `f = IFile(fname);` in MSVC 2013
-    IFile(IFile &&f) : fh(std::move(f.fh)), buffer(std::move(f.buffer)), buffer_pos(f.buffer_pos), buffer_size(f.buffer_size), buffer_capacity(f.buffer_capacity), file_pos_of_buffer_start(f.file_pos_of_buffer_start), is_eof_reached(f.is_eof_reached), eof_indicator(f.eof_indicator) {}
+    IFile(IFile &&f) : fh(std::move(f.fh)), buffer(std::move(f.buffer)), buffer_pos(f.buffer_pos), buffer_size(f.buffer_size), buffer_capacity(f.buffer_capacity), file_pos_of_buffer_start(f.file_pos_of_buffer_start), is_eof_reached(f.is_eof_reached), eof_indicator(f.eof_indicator), block_cache(std::move(f.block_cache)) {}
     IFile &operator=(IFile &&f)
     {
         move_assign(this, std::move(f));
@@ -126,6 +437,8 @@ public:
     void close()
     {
         fh.close();
+        if (block_cache != nullptr)
+            block_cache->clear();
         buffer_pos = 0;
         buffer_size = 0;
         file_pos_of_buffer_start = 0;
@@ -140,6 +453,24 @@ public:
         buffer_capacity = sz;
     }
 
+    /*
+    Enables a block cache of `capacity` bytes for random-access reads: the file is read in aligned blocks of `block_size` bytes [which also becomes the buffer size],
+    and `seek()`, `read_bytes()`, `read_struct()` and other reads take recently used blocks from the cache instead of re-reading them from the file.
+    Must be called before the first read, and only for files which support positioning; the file must not be modified while it is read.
+    */
+    void enable_block_cache(size_t capacity, size_t block_size = 4*1024)
+    {
+        if (buffer != nullptr)
+            throw IFileBufferAlreadyAllocated();
+        if (block_size == 0 || (block_size & (block_size - 1)) != 0)
+            throw BlockSizeMustBeAPowerOfTwo();
+        if (fh.get_file_size() == -2)
+            throw FileDoesNotSupportPositioning();
+
+        buffer_capacity = block_size;
+        block_cache.reset(new detail::BlockCache(capacity, block_size));
+    }
+
     int64_t get_file_size()
     {
         int64_t file_size = fh.get_file_size();
@@ -187,6 +518,12 @@ public:
         if (new_pos > get_file_size())
             throw SeekFailed();
 
+        if (block_cache != nullptr) {
+            read_block(new_pos & ~int64_t(buffer_capacity - 1));
+            buffer_pos = size_t(new_pos - file_pos_of_buffer_start);
+            return;
+        }
+
         allocate_buffer();
 
         file_pos_of_buffer_start = new_pos & ~(IFILE_BUFFER_SIZE_RIGHT_AFTER_SEEK - 1);
@@ -241,40 +578,73 @@ public:
 
     std::string read_text() // reads whole file and returns its contents as a string; only works if the file pointer is at the beginning of the file (`read_text_to_end()` has no such limitation)
     {
-        if (!(file_pos_of_buffer_start == 0 && buffer_pos == 0 && buffer_size == 0))
-            throw ReadTextMustBeCalledAtTheBeginningOfTheFile();
-
         std::string file_str;
-        int64_t file_size = fh.get_file_size();
-        if (file_size != -2) {
-            if (uint64_t(file_size) > SIZE_MAX)
-                throw FileIsTooLargeToFitInMemory();
-            size_t file_sz = (size_t)file_size;
-            file_str.resize(file_sz);
-            if (fh.read((char*)file_str.data(), file_sz) != file_sz)
-                throw OSReportedIncorrectFileSize();
-            file_pos_of_buffer_start = file_size;
+        read_text(file_str);
+        return file_str;
+    }
 
-            // Remove the BOM at the beginning of the file, if present
-            if (file_str.length() >= 3 && is_bom((uint8_t*)file_str.data()))
-                file_str.erase(0, 3);
-        }
-        else { // file size is unknown, so read via buffer
-            if (!has_no_data_left()) {
-                // Skip the BOM at the beginning of the file, if present
-                if (buffer_size >= 3 && is_bom(buffer.get()))
-                    buffer_pos = 3;
+    void read_text(std::string &file_str) // the same as `read_text()`, but reuses the capacity of `file_str` [which is useful when reading many files in a loop]
+    {
+        if (!(file_pos_of_buffer_start == 0 && buffer_pos == 0 && buffer_size == 0))
+            throw ReadTextMustBeCalledAtTheBeginningOfTheFile();
 
-                // Read the rest
-                do {
-                    file_str.append(buffer.get() + buffer_pos, buffer.get() + buffer_size);
+        uint8_t small[IFILE_SMALL_FILE_SIZE];
+        size_t n;
+        if (read_small_file(small, n))
+            file_str.assign((char*)small, n);
+        else {
+            size_t rest = rest_of_file_size(n);
+            if (rest != SIZE_MAX) {
+                size_t read_sz;
+#ifdef __cpp_lib_string_resize_and_overwrite // the string is not zero-filled before reading
+                std::exception_ptr error;
+                file_str.resize_and_overwrite(n + rest, [&](char *p, size_t) {
+                    memcpy(p, small, n);
+                    try {
+                        read_sz = fh.read(p + n, rest);
+                    }
+                    catch (...) { // `resize_and_overwrite()` must not be left via an exception
+                        error = std::current_exception();
+                        read_sz = 0;
+                    }
+                    return n + read_sz;
+                });
+                if (error != nullptr)
+                    std::rethrow_exception(error);
+#else // `resize()` zero-fills, so the string is grown in steps which are overwritten by `read()` while they are still in the cache
+      // [rather than zero-filling the whole string in an extra pass over memory; the part within the current size of `file_str` needs no filling]
+                file_str.reserve(n + rest);
+                file_str.resize((std::max)(n, (std::min)(file_str.size(), n + rest)));
+                memcpy(&file_str[0], small, n);
+                for (read_sz = 0; read_sz < rest;) {
+                    size_t pos = n + read_sz, step = file_str.size() > pos ? file_str.size() - pos : (std::min)(rest - read_sz, IFILE_READ_TEXT_STEP_SIZE);
+                    if (file_str.size() < pos + step)
+                        file_str.resize(pos + step);
+                    size_t r = fh.read(&file_str[pos], step);
+                    read_sz += r;
+                    if (r != step)
+                        break;
+                }
+                file_str.resize(n + read_sz);
+#endif
+                if (read_sz != rest)
+                    throw OSReportedIncorrectFileSize();
+                file_pos_of_buffer_start = n + rest;
+            }
+            else { // file size is unknown, so read via buffer
+                file_str.assign((char*)small, n);
+                while (!has_no_data_left()) {
+                    file_str.append(buffer.get(), buffer.get() + buffer_size);
                     buffer_pos = buffer_size;
-                } while (!has_no_data_left());
+                }
             }
         }
 
+        // Remove the BOM at the beginning of the file, if present
+        if (file_str.length() >= 3 && is_bom((uint8_t*)file_str.data()))
+            file_str.erase(0, 3);
+
         handle_newlines(file_str);
-        return file_str;
     }
 
     std::string read_text_to_end() // the method name was inspired by [https://doc.rust-lang.org/std/io/trait.Read.html#method.read_to_end]
@@ -356,6 +726,47 @@ public:
         return r;
     }
 
+    /*
+    Reads the line which ends right before the current position, and moves the position to the beginning of this line, so that the last lines of a file can be read
+    without reading the whole file:
+        f.seek(f.get_file_size());
+        while (f.tell() > 0) // the lines are returned in reverse order
+            f.read_line_backward();
+    Newlines and the BOM are handled in the same way as in `read_line()`. Only works for files which support positioning.
+    */
+    void read_line_backward(std::string &r, bool keep_newline = false)
+    {
+        int64_t pos = tell();
+        if (pos == 0)
+            throw UnexpectedEOF();
+
+        // Skip the terminator of this line [the last line of the file may have no terminator]
+        load_block_before(pos);
+        int64_t line_end = buffer[size_t(pos - 1 - file_pos_of_buffer_start)] == '\n' ? pos - 1 : pos;
+
+        // Find the end of the previous line
+        int64_t line_start = 0;
+        for (int64_t p = line_end; p > 0; p = file_pos_of_buffer_start) {
+            load_block_before(p);
+            if (const uint8_t *nl = find_last(buffer.get(), buffer.get() + size_t(p - file_pos_of_buffer_start), '\n')) {
+                line_start = file_pos_of_buffer_start + (nl - buffer.get()) + 1;
+                break;
+            }
+        }
+
+        // Read the line forward [usually it is in the buffer already], and return to its beginning
+        seek(line_start);
+        read_line(r, keep_newline);
+        seek(line_start);
+    }
+
+    std::string read_line_backward(bool keep_newline = false)
+    {
+        std::string r;
+        read_line_backward(r, keep_newline);
+        return r;
+    }
+
     std::string read_line_reae(bool keep_newline = false) // ‘r’‘e’‘a’‘e’ means ‘r’eturns ‘e’mpty [string] (‘a’t ‘e’nd of file);
     {                                                     // `read_line_reae()` corresponds to `std::getline()` in C++,
         if (at_eof()) {                                   // `read_line_reae(true)` corresponds to `readline()` in Python and to `read_line()` in Rust.
@@ -415,19 +826,22 @@ public:
         if (!(file_pos_of_buffer_start == 0 && buffer_pos == 0 && buffer_size == 0))
             throw ReadBytesMustBeCalledAtTheBeginningOfTheFile();
 
-        int64_t file_size = fh.get_file_size();
-        if (file_size != -2) {
-            if (uint64_t(file_size) > SIZE_MAX)
-                throw FileIsTooLargeToFitInMemory();
-            size_t file_sz = (size_t)file_size;
-            std::vector<uint8_t> r(file_sz);
-            if (fh.read(r.data(), file_sz) != file_sz)
+        uint8_t small[IFILE_SMALL_FILE_SIZE];
+        size_t n;
+        if (read_small_file(small, n))
+            return std::vector<uint8_t>(small, small + n);
+
+        size_t rest = rest_of_file_size(n);
+        if (rest != SIZE_MAX) {
+            std::vector<uint8_t> r(n + rest);
+            memcpy(r.data(), small, n);
+            if (fh.read(r.data() + n, rest) != rest)
                 throw OSReportedIncorrectFileSize();
-            file_pos_of_buffer_start = file_size;
+            file_pos_of_buffer_start = n + rest;
             return r;
         }
         else { // file size is unknown, so read via buffer
-            std::vector<uint8_t> r;
+            std::vector<uint8_t> r(small, small + n);
             while (!has_no_data_left()) {
                 r.insert(r.end(), buffer.get(), buffer.get() + buffer_size);
                 buffer_pos = buffer_size;
@@ -436,6 +850,60 @@ public:
         }
     }
 
+    // The same as `read_bytes()`, but the result is not zero-filled before reading [so reading a large file costs one pass over memory instead of two]
+    FileBuffer read_bytes_uninitialized(bool huge_pages = false)
+    {
+        if (!(file_pos_of_buffer_start == 0 && buffer_pos == 0 && buffer_size == 0))
+            throw ReadBytesMustBeCalledAtTheBeginningOfTheFile();
+
+        uint8_t small[IFILE_SMALL_FILE_SIZE];
+        size_t n;
+        bool whole_file_is_read = read_small_file(small, n);
+        size_t rest = whole_file_is_read ? 0 : rest_of_file_size(n);
+        if (rest != SIZE_MAX) {
+            FileBuffer r(n + rest, huge_pages);
+            memcpy(r.data(), small, n);
+            if (rest != 0) {
+                if (fh.read(r.data() + n, rest) != rest)
+                    throw OSReportedIncorrectFileSize();
+                file_pos_of_buffer_start = n + rest;
+            }
+            return r;
+        }
+        else { // file size is unknown, so read with doubling of the buffer
+            FileBuffer r((std::max)(buffer_capacity, 2*n), huge_pages);
+            memcpy(r.data(), small, n);
+            r.sz = n;
+            while (true) {
+                r.sz += read_bytes_at_most(r.data() + r.sz, r.capacity - r.sz);
+                if (r.sz < r.capacity)
+                    return r;
+                FileBuffer larger(r.capacity * 2, huge_pages);
+                memcpy(larger.data(), r.data(), r.sz);
+                larger.sz = r.sz;
+                r = std::move(larger);
+            }
+        }
+    }
+
+    size_t read_bytes_to_end(uint8_t *p, size_t capacity) // reads the rest of the file into a caller-owned buffer; throws `FileIsTooLargeToFitInMemory` if the rest does not fit in `capacity` bytes
+    {
+        int64_t file_size = fh.get_file_size();
+        if (file_size != -2) {
+            file_size -= tell();
+            if (uint64_t(file_size) > capacity)
+                throw FileIsTooLargeToFitInMemory();
+            read_bytes(p, (size_t)file_size);
+            return (size_t)file_size;
+        }
+        else { // file size is unknown, so read via buffer
+            size_t n = read_bytes_at_most(p, capacity);
+            if (n == capacity && !at_eof())
+                throw FileIsTooLargeToFitInMemory();
+            return n;
+        }
+    }
+
     std::vector<uint8_t> read_bytes_to_end()
     {
         int64_t file_size = fh.get_file_size();
@@ -493,7 +961,7 @@ public:
             if (count != 0)
                 throw UnexpectedEOF();
 
-        if (check_for_large_read && count > buffer_capacity) { // optimize large reads (avoid extra `read()` syscalls)
+        if (check_for_large_read && count > buffer_capacity && block_cache == nullptr) { // optimize large reads (avoid extra `read()` syscalls)
             // First of all, copy all of the remaining bytes in the buffer
             size_t n = buffer_size - buffer_pos;
             assert(count >= n);
@@ -547,6 +1015,311 @@ public:
         return r;
     }
 
+    /*
+    Reads a varint [LEB128, as in protobuf]; a varint of up to 10 bytes is accepted for any `T`, and the value is truncated to `T` [as negative `int32`
+    values are encoded as 10-byte varints by protobuf]. Varints are decoded directly from the buffer, and are read byte by byte only near the end of it.
+    */
+    template <typename T = uint64_t> T read_varint()
+    {
+        static_assert(std::is_integral<T>::value, "read_varint() requires an integer type");
+        uint64_t v;
+        if (buffer_size - buffer_pos >= 10) {
+            size_t len = detail::decode_varint(buffer.get() + buffer_pos, v);
+            if (len == 0)
+                throw VarintIsTooLong();
+            buffer_pos += len;
+            return T(v);
+        }
+
+        v = 0;
+        for (int shift = 0; shift < 70; shift += 7) {
+            uint8_t b = read_byte();
+            v |= uint64_t(b & 0x7F) << shift;
+            if (b < 0x80)
+                return T(v);
+        }
+        throw VarintIsTooLong();
+    }
+
+    template <typename T = int64_t> T read_zigzag() // reads a signed value encoded with ZigZag [as `sint32`/`sint64` in protobuf]
+    {
+        static_assert(std::is_signed<T>::value, "read_zigzag() requires a signed type");
+        typedef typename std::make_unsigned<T>::type U;
+        U v = read_varint<U>();
+        return T((v >> 1) ^ (U)-(v & 1));
+    }
+
+    template <typename T = uint64_t> void read_varints(T *out, size_t n) // reads `n` varints [as `read_varint<T>()`]
+    {
+        static_assert(std::is_integral<T>::value, "read_varints() requires an integer type");
+        for (size_t i = 0; i < n;) {
+            if (buffer_size - buffer_pos < 10) {
+                out[i++] = read_varint<T>();
+                continue;
+            }
+            const uint8_t *p = buffer.get() + buffer_pos;
+            if (n - i >= 8 && (detail::read64(p) & 0x8080808080808080ULL) == 0) { // 8 single-byte varints
+                for (int k = 0; k < 8; k++)
+                    out[i + k] = T(p[k]);
+                i += 8;
+                buffer_pos += 8;
+                continue;
+            }
+            uint64_t v;
+            size_t len = detail::decode_varint(p, v);
+            if (len == 0)
+                throw VarintIsTooLong();
+            out[i++] = T(v);
+            buffer_pos += len;
+        }
+    }
+
+    /*
+    Returns the bytes at the current position directly from the buffer [without copying], at least `n` of them unless the end of file is reached first:
+        ByteSpan s = f.peek_span(4);
+        uint32_t len; memcpy(&len, s.data, 4);
+        s = f.peek_span(4 + len);
+        decode_frame(s.data + 4, len);
+        f.consume(4 + len);
+    The remaining data is moved to the beginning of the buffer, and the buffer grows if `n` exceeds its capacity.
+    The span is valid until the next read or seek.
+    */
+    ByteSpan peek_span(size_t n)
+    {
+        if (buffer_size - buffer_pos >= n)
+            return ByteSpan{buffer.get() + buffer_pos, buffer_size - buffer_pos};
+        if (block_cache != nullptr) // the buffer must stay aligned to the cache blocks
+            throw PeekSpanIsNotSupportedWithBlockCache();
+
+        // Move the remaining data to the beginning of the buffer [into a larger buffer, if needed]
+        size_t rest = buffer_size - buffer_pos;
+        if (n > buffer_capacity) {
+            size_t new_capacity = (std::max)(n, buffer_capacity * 2);
+            std::unique_ptr<uint8_t[]> new_buffer(new uint8_t[new_capacity]);
+            if (rest != 0)
+                memcpy(new_buffer.get(), buffer.get() + buffer_pos, rest);
+            buffer = std::move(new_buffer);
+            buffer_capacity = new_capacity;
+        }
+        else {
+            allocate_buffer();
+            memmove(buffer.get(), buffer.get() + buffer_pos, rest);
+        }
+        file_pos_of_buffer_start += buffer_pos;
+        buffer_pos = 0;
+        buffer_size = rest;
+
+        // Fill the rest of the buffer
+        if (!is_eof_reached) {
+            size_t r = fh.read(buffer.get() + buffer_size, buffer_capacity - buffer_size);
+            if (r < buffer_capacity - buffer_size)
+                is_eof_reached = true;
+            buffer_size += r;
+        }
+        return ByteSpan{buffer.get(), buffer_size};
+    }
+
+    void consume(size_t n) // skips `n` bytes of the span returned by `peek_span()`
+    {
+        if (n > buffer_size - buffer_pos)
+            throw ConsumeBeyondPeekedSpan();
+        buffer_pos += n;
+    }
+
+    /*
+    Calls `callback(ByteSpan)` for consecutive windows of data from the current position up to the end of file [or up to `count` bytes, if `count` != -1],
+    without copying the data out of the buffer, and returns the number of bytes visited. If a lot of data remains, it bypasses the buffer [as in `read_bytes()`]
+    and is read directly into windows of up to `IFILE_DIRECT_CHUNK_SIZE` bytes. The spans are valid only during the call of `callback`.
+    */
+    template <class Callback> int64_t for_each_chunk(Callback &&callback, int64_t count = -1)
+    {
+        uint64_t remaining = count == -1 ? UINT64_MAX : uint64_t(count);
+        int64_t visited = 0;
+
+        // First of all, visit the bytes that are already in the buffer
+        size_t n = (size_t)(std::min)(uint64_t(buffer_size - buffer_pos), remaining);
+        if (n != 0) {
+            callback(ByteSpan{buffer.get() + buffer_pos, n});
+            buffer_pos += n;
+            remaining -= n;
+            visited += n;
+        }
+
+        // Read large amounts of data directly into large windows
+        if (remaining > buffer_capacity && !is_eof_reached && block_cache == nullptr && fh.get_file_size() != -2) {
+            size_t window_size = (size_t)(std::min)(remaining, uint64_t(IFILE_DIRECT_CHUNK_SIZE));
+            std::unique_ptr<uint8_t[]> window(new uint8_t[window_size]);
+            file_pos_of_buffer_start += buffer_size; // the buffer is empty now, and the file position of `fh` is right after it
+            buffer_pos = buffer_size = 0;
+            while (remaining > buffer_capacity) {
+                size_t to_read = (size_t)(std::min)(remaining, uint64_t(window_size));
+                size_t r = fh.read(window.get(), to_read);
+                file_pos_of_buffer_start += r;
+                if (r != 0) {
+                    callback(ByteSpan{window.get(), r});
+                    remaining -= r;
+                    visited += r;
+                }
+                if (r < to_read) {
+                    is_eof_reached = true;
+                    break;
+                }
+            }
+        }
+
+        while (remaining != 0 && !at_eof()) {
+            n = (size_t)(std::min)(uint64_t(buffer_size - buffer_pos), remaining);
+            callback(ByteSpan{buffer.get() + buffer_pos, n});
+            buffer_pos += n;
+            remaining -= n;
+            visited += n;
+        }
+        if (count != -1 && remaining != 0)
+            throw UnexpectedEOF();
+        return visited;
+    }
+
+    // Calls `pred(ByteSpan)` for consecutive windows of the buffer; `pred` returns the number of bytes it has consumed, and visiting stops when `pred`
+    // consumes less than the whole window [e.g. when it finds what it looks for] or at the end of file. Returns the total number of bytes consumed.
+    template <class Pred> int64_t for_each_chunk_until(Pred &&pred)
+    {
+        int64_t consumed = 0;
+        while (!at_eof()) {
+            size_t available = buffer_size - buffer_pos;
+            size_t n = pred(ByteSpan{buffer.get() + buffer_pos, available});
+            if (n > available)
+                throw ConsumeBeyondPeekedSpan();
+            buffer_pos += n;
+            consumed += n;
+            if (n < available)
+                break;
+        }
+        return consumed;
+    }
+
+    /*
+    Moves the position to the next occurrence of `needle` and returns its offset in the file; if there are no more occurrences, moves to the end of file and returns -1:
+        while (f.find("token=") != -1)
+            audit(f.read_line());
+    The buffer is searched with a vectorized filter [see SubstringSearch.hpp], and occurrences straddling two fills of the buffer are found too, as the last
+    `needle.size() - 1` bytes of the buffer are kept for the next fill [with the block cache enabled, `needle` must not be longer than a block].
+    */
+    int64_t find(utf::std::string_view needle)
+    {
+        const uint8_t *nd = (const uint8_t*)needle.data();
+        size_t m = needle.size();
+        if (at_eof())
+            return m == 0 ? tell() : -1;
+        if (skip_bom(false)) // the file consists of the BOM only
+            buffer_pos = buffer_size;
+
+        while (true) {
+            if (const uint8_t *p = detail::find_substring(buffer.get() + buffer_pos, buffer_size - buffer_pos, nd, m)) {
+                buffer_pos = p - buffer.get();
+                return tell();
+            }
+
+            size_t keep = (std::min)(m - 1, buffer_size - buffer_pos); // the tail which can be the beginning of an occurrence
+            buffer_pos = buffer_size - keep;
+            if (block_cache == nullptr) {
+                if (peek_span(keep + 1).size <= keep) { // the tail is moved to the beginning of the buffer, and the rest of the buffer is filled
+                    buffer_pos = buffer_size;
+                    return -1;
+                }
+            }
+            else { // the buffer can not be refilled partially, so the tail is joined with the head of the next block and is searched separately
+                std::string joined((const char*)buffer.get() + buffer_pos, keep);
+                int64_t joined_pos = tell();
+                buffer_pos = buffer_size;
+                if (has_no_data_left())
+                    return -1;
+                joined.append((const char*)buffer.get(), (std::min)(m - 1, buffer_size));
+                if (const uint8_t *p = detail::find_substring((const uint8_t*)joined.data(), joined.size(), nd, m)) {
+                    seek(joined_pos + (p - (const uint8_t*)joined.data()));
+                    return tell();
+                }
+            }
+        }
+    }
+
+    int64_t count_occurrences(utf::std::string_view needle) // counts non-overlapping occurrences of `needle` from the current position to the end of file [and moves to the end of file]
+    {
+        if (needle.size() == 0)
+            throw CountOccurrencesOfAnEmptyString();
+
+        int64_t count = 0;
+        while (find(needle) != -1) {
+            if (buffer_size - buffer_pos >= needle.size())
+                buffer_pos += needle.size();
+            else // the occurrence extends to the next block of the cache
+                seek(tell() + needle.size());
+            count++;
+        }
+        return count;
+    }
+
+    /*
+    Counts the lines from the current position to the end of file [and moves to the end of file], without extracting them. A final line without a terminating
+    newline is counted too, as `read_line_reae()` returns it. Newlines are counted by a vectorized loop over large windows [see `for_each_chunk()`].
+    */
+    int64_t count_lines()
+    {
+        if (at_eof())
+            return 0;
+        if (skip_bom(false)) { // the file consists of the BOM only
+            buffer_pos = buffer_size;
+            return 0;
+        }
+
+        int64_t count = 0;
+        uint8_t last = 0;
+        for_each_chunk([&count, &last](ByteSpan s) {
+            count += detail::count_byte(s.data, s.size, '\n');
+            last = s.data[s.size - 1];
+        });
+        return count + int(last != '\n');
+    }
+
+    // Counts the lines of the file at `path` as `IFile(path).count_lines()` does, but a large regular file is split into ranges, which are counted by
+    // `threads` threads [0 means one thread per core] via positional reads
+    static int64_t count_lines(const std::string &path, unsigned threads = 0)
+    {
+        IFile f(path);
+        int64_t size = f.fh.get_file_size();
+        if (threads == 0)
+            threads = (std::max)(std::thread::hardware_concurrency(), 1u);
+        if (size < 0 || size / int64_t(IFILE_LINE_COUNT_RANGE_SIZE) < 2 || threads == 1) // the size is unknown [e.g. for a pipe] or the file is not large enough
+            return f.count_lines();
+        threads = (unsigned)(std::min)(int64_t(threads), size / int64_t(IFILE_LINE_COUNT_RANGE_SIZE));
+
+        auto count_range = [&f](int64_t begin, int64_t end) {
+            std::unique_ptr<uint8_t[]> window(new uint8_t[IFILE_DIRECT_CHUNK_SIZE]);
+            int64_t count = 0;
+            for (int64_t pos = begin; pos < end;) {
+                size_t r = f.fh.read_at(window.get(), (size_t)(std::min)(end - pos, int64_t(IFILE_DIRECT_CHUNK_SIZE)), pos);
+                if (r == 0)
+                    break;
+                count += detail::count_byte(window.get(), r, '\n');
+                pos += r;
+            }
+            return count;
+        };
+
+        // The BOM does not affect the count, as the file is not empty after it
+        int64_t range_size = (size / threads + 4095) & ~int64_t(4095);
+        std::vector<std::future<int64_t>> counts;
+        for (unsigned i = 1; i < threads; i++)
+            counts.push_back(std::async(std::launch::async, count_range, range_size * i, i + 1 == threads ? size : (std::min)(range_size * (i + 1), size))); // the last range always ends at `size` [`range_size * threads` may be less than it]
+        int64_t count = count_range(0, (std::min)(range_size, size)); // the calling thread counts the first range
+        for (std::future<int64_t> &c : counts)
+            count += c.get(); // rethrows `IOError` from the thread
+
+        uint8_t last;
+        if (f.fh.read_at(&last, 1, size - 1) == 1 && last != '\n')
+            count++;
+        return count;
+    }
+
     bool starts_with(utf::std::string_view s) // s — signature/‘sequence of chars’
     {
         if (!(file_pos_of_buffer_start == 0 && buffer_pos == 0))
@@ -558,6 +1331,16 @@ public:
         return buffer_size >= s.size() && memcmp(buffer.get(), s.data(), s.size()) == 0;
     }
 
+    // Passthrough of data to `out` [these functions are defined in OFile.hpp; see `OFile::write_from()` and `OFile::write_until()`]
+    int64_t forward_bytes(OFile &out, int64_t n = -1);
+    int64_t forward_until(OFile &out, char delim, bool keep_delim = false);
+
     UnixNanotime   get_creation_time() {return   fh.get_creation_time();}
     UnixNanotime get_last_write_time() {return fh.get_last_write_time();}
+    const FileInfo &get_file_info() {return fh.get_file_info();}
+    const FileInfo &refresh() {return fh.refresh();}
+
+    // Hashes all data as it is read from the file [at each refill of the buffer and on large direct reads], so that a checksum is computed in the same pass.
+    // The file must be read sequentially [data read after `seek()` and via the block cache is not hashed]; `checksum` must outlive reading.
+    void set_checksum(Checksum *checksum) {fh.checksum = checksum;}
 };
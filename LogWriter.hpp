@@ -0,0 +1,252 @@
+#pragma once
+#include "OFile.hpp"
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <exception> // for std::exception_ptr
+#include <string.h> // for memcpy and memset [GCC]
+
+class LogRecordIsTooLarge {};
+
+enum class LogOverflow
+{
+    block, // `write()` waits until the consumer frees enough space in the ring [sleeping on a condition variable after a short spin]
+    drop,  // `write()` discards the record and returns false
+};
+
+/*
+Multi-producer front end for `OFile`: any number of threads call `write()`, which reserves space in a lock-free ring buffer and copies the record into it,
+and a single consumer thread drains the ring into `OFile::write()`. Records written by one thread appear in the file in the order they were written.
+The `OFile` must not be used directly while the `LogWriter` exists.
+The consumer flushes the `OFile` when the ring becomes empty, when `flush()` is waiting, and after each `FLUSH_INTERVAL` bytes under sustained load;
+when there is no work, it sleeps until a producer wakes it.
+
+Ring layout: each record starts at an 8-byte aligned position with an 8-byte header [payload length in the low 32 bits, `COMMITTED` and `PADDING` flags above],
+followed by the payload padded to a multiple of 8 bytes. A record never wraps around the end of the ring: the rest of the ring is filled with a padding record
+instead. The consumer zeroes consumed records, so a header becomes non-zero only when a producer commits it.
+*/
+class LogWriter
+{
+    static const uint64_t COMMITTED = uint64_t(1) << 32;
+    static const uint64_t PADDING   = uint64_t(1) << 33;
+    static const uint64_t FLUSH_INTERVAL = 1024*1024;
+
+    OFile &file;
+    std::unique_ptr<uint64_t[]> ring_storage; // `uint64_t` for 8-byte alignment of headers
+    uint8_t *ring;
+    size_t capacity, mask;
+    LogOverflow overflow;
+
+    std::atomic<uint64_t> reserve_pos{0}, consume_pos{0}, dropped{0}, flush_request{0}; // `flush_request` is the largest target position of `flush()`
+    std::atomic<bool> consumer_sleeping{false}, stop_requested{false};
+    std::atomic<unsigned> producers_waiting{0}; // producers sleeping until the ring has free space
+
+    std::mutex mutex;
+    std::condition_variable consumer_cv, flush_cv, space_cv;
+    uint64_t flushed_pos = 0;
+    std::exception_ptr error;
+
+    std::thread consumer; // must be the last member, as it uses all the others
+
+    std::atomic<uint64_t> &header(uint64_t pos)
+    {
+        static_assert(sizeof(std::atomic<uint64_t>) == sizeof(uint64_t), "std::atomic<uint64_t> must be lock-free");
+        return *reinterpret_cast<std::atomic<uint64_t>*>(ring + (pos & mask));
+    }
+
+    static size_t record_size(size_t sz) {return 8 + ((sz + 7) & ~size_t(7));}
+
+    void set_error()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        error = std::current_exception();
+        flush_cv.notify_all();
+    }
+
+    void flush_file(uint64_t pos)
+    {
+        if (error == nullptr) {
+            try {
+                file.flush();
+            }
+            catch (...) {
+                set_error();
+            }
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        flushed_pos = pos;
+        flush_cv.notify_all();
+    }
+
+    void wake_consumer()
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst); // pairs with the fence in `consume()`, so that either the consumer sees the new record or this thread sees it sleeping
+        if (consumer_sleeping.load(std::memory_order_relaxed)) {
+            std::lock_guard<std::mutex> lock(mutex); // the consumer holds the mutex until it is inside `wait()`, so the notification can not be lost
+            consumer_cv.notify_one();
+        }
+    }
+
+    // Sleeps until the consumer advances `consume_pos` past `consumed`. The consumer wakes waiting producers after each quarter of the ring it frees:
+    // a producer waits only when the ring is full, and a record takes at most half of it, so at least half of the ring is ahead of the consumer,
+    // and a wakeup past `consumed` is certain.
+    void wait_for_space(uint64_t consumed)
+    {
+        producers_waiting.fetch_add(1);
+        std::atomic_thread_fence(std::memory_order_seq_cst); // pairs with the fence in `consume()`, so that either the consumer sees this producer waiting or it sees the new `consume_pos`
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            space_cv.wait(lock, [&]{return consume_pos.load(std::memory_order_acquire) != consumed;});
+        }
+        producers_waiting.fetch_sub(1);
+    }
+
+    void consume()
+    {
+        uint64_t pos = 0, last_flushed = 0, notified_pos = 0;
+        int idle_spins = 0;
+
+        while (true) {
+            uint64_t h = header(pos).load(std::memory_order_acquire);
+            if (h & COMMITTED) {
+                size_t off = size_t(pos & mask), sz;
+                if (h & PADDING)
+                    sz = capacity - off;
+                else {
+                    sz = record_size(uint32_t(h));
+                    if (error == nullptr) {
+                        try {
+                            file.write(ring + off + 8, uint32_t(h));
+                        }
+                        catch (...) {
+                            set_error(); // keep draining the ring, so that producers are not blocked forever
+                        }
+                    }
+                }
+                memset(ring + off, 0, sz);
+                pos += sz;
+                consume_pos.store(pos, std::memory_order_release);
+                std::atomic_thread_fence(std::memory_order_seq_cst); // see `wait_for_space()`
+                if (producers_waiting.load(std::memory_order_relaxed) != 0 && pos - notified_pos >= capacity / 4) { // waking producers on each record would make them thrash
+                    std::lock_guard<std::mutex> lock(mutex);
+                    space_cv.notify_all();
+                    notified_pos = pos;
+                }
+                idle_spins = 0;
+                uint64_t requested = flush_request.load(std::memory_order_acquire);
+                if ((requested > last_flushed && pos >= requested) || pos - last_flushed >= FLUSH_INTERVAL) { // `flush()` is waiting, or the ring is never empty
+                    flush_file(pos);
+                    last_flushed = pos;
+                }
+                continue;
+            }
+
+            // The ring is empty [or the next record is not committed yet]
+            if (++idle_spins < 64) {
+                std::this_thread::yield();
+                continue;
+            }
+            if (pos != last_flushed) { // flush the `OFile` buffer when there is no more work, so that records reach the file without much delay
+                flush_file(pos);
+                last_flushed = pos;
+            }
+            if (stop_requested.load() && pos == reserve_pos.load())
+                return;
+
+            std::unique_lock<std::mutex> lock(mutex);
+            consumer_sleeping.store(true, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst); // see `wake_consumer()`
+            if (!(header(pos).load(std::memory_order_acquire) & COMMITTED) && !stop_requested.load())
+                consumer_cv.wait(lock);
+            consumer_sleeping.store(false, std::memory_order_relaxed);
+            idle_spins = 0;
+        }
+    }
+
+public:
+    // `ring_capacity` is rounded up to a power of two; a single record may take at most half of the ring
+    LogWriter(OFile &file, size_t ring_capacity = 1024*1024, LogOverflow overflow = LogOverflow::block) : file(file), overflow(overflow)
+    {
+        capacity = 64;
+        while (capacity < ring_capacity)
+            capacity *= 2;
+        mask = capacity - 1;
+        ring_storage.reset(new uint64_t[capacity / 8]());
+        ring = (uint8_t*)ring_storage.get();
+        consumer = std::thread(&LogWriter::consume, this);
+    }
+
+    LogWriter(const LogWriter &) = delete;
+    void operator=(const LogWriter &) = delete;
+
+    ~LogWriter()
+    {
+        stop_requested = true;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            consumer_cv.notify_one();
+        }
+        consumer.join();
+    }
+
+    bool write(const void *p, size_t sz) // returns false if the record has been dropped because the ring is full [in `LogOverflow::drop` mode]
+    {
+        size_t rec_size = record_size(sz);
+        if (rec_size > capacity / 2 || sz > 0xFFFFFFFFu)
+            throw LogRecordIsTooLarge();
+
+        // Reserve space
+        uint64_t pos = reserve_pos.load(std::memory_order_relaxed), padding;
+        int full_spins = 0;
+        while (true) {
+            size_t off = size_t(pos & mask);
+            padding = off + rec_size > capacity ? capacity - off : 0;
+            uint64_t consumed = consume_pos.load(std::memory_order_acquire);
+            if (pos + padding + rec_size - consumed > capacity) { // the ring is full
+                if (overflow == LogOverflow::drop) {
+                    dropped.fetch_add(1, std::memory_order_relaxed);
+                    return false;
+                }
+                wake_consumer();
+                if (++full_spins < 16)
+                    std::this_thread::yield();
+                else
+                    wait_for_space(consumed); // the consumer is behind, so do not burn a core while waiting for it
+                pos = reserve_pos.load(std::memory_order_relaxed);
+                continue;
+            }
+            if (reserve_pos.compare_exchange_weak(pos, pos + padding + rec_size, std::memory_order_relaxed))
+                break;
+        }
+
+        // Copy the record and commit it
+        if (padding != 0) {
+            header(pos).store(COMMITTED | PADDING, std::memory_order_release);
+            pos += padding;
+        }
+        memcpy(ring + size_t(pos & mask) + 8, p, sz);
+        header(pos).store(COMMITTED | sz, std::memory_order_release);
+
+        wake_consumer();
+        return true;
+    }
+
+    bool write(utf::std::string_view s)
+    {
+        return write(s.data(), s.size());
+    }
+
+    void flush() // waits until all records written before this call are passed to the OS; rethrows an error that occurred in the consumer thread
+    {
+        uint64_t target = reserve_pos.load(), requested = flush_request.load();
+        while (requested < target && !flush_request.compare_exchange_weak(requested, target)) {}
+        std::unique_lock<std::mutex> lock(mutex);
+        consumer_cv.notify_one();
+        flush_cv.wait(lock, [&]{return flushed_pos >= target || error != nullptr;});
+        if (error != nullptr)
+            std::rethrow_exception(error);
+    }
+
+    uint64_t get_dropped_count() const {return dropped.load(std::memory_order_relaxed);}
+};
@@ -0,0 +1,167 @@
+#pragma once
+#include "IFile.hpp"
+#include <future>
+
+/*
+Reads an ordered list of files [e.g. `part-00000` ... `part-04095`] as one logical stream with the reading API of `IFile`.
+While the current file is read, the next one is opened and the head of it is read by a background thread, so that the reader does not wait for
+`open()` and the first `read()` at each file boundary. The BOM at the beginning of each file is handled as in `IFile` [a file with only a BOM is skipped once text reading methods are used, and is read as data otherwise].
+By default, the last line of a file without a terminating newline is returned as a separate line; if `join_lines` is true, it is joined with the first line of the next file.
+*/
+class MultiFileReader
+{
+    std::vector<std::string> paths;
+    size_t index = 0; // index of the current file
+    IFile file;
+    std::future<IFile> next_file; // the prefetched next file
+    bool join_lines;
+    bool text_read = false; // set by the text reading methods; then a file with only a BOM is skipped, as it is empty for text reading [but not for binary reading]
+
+    void prefetch_next()
+    {
+        if (index + 1 < paths.size())
+            next_file = std::async(std::launch::async, [](std::string path) {
+                IFile f(path);
+                f.at_eof(); // fills the buffer
+                return f;
+            }, paths[index + 1]);
+    }
+
+    bool open_next()
+    {
+        if (index + 1 >= paths.size())
+            return false;
+        file = next_file.get(); // rethrows `FileOpenError` if the next file can not be opened
+        index++;
+        prefetch_next();
+        return true;
+    }
+
+public:
+    MultiFileReader(std::vector<std::string> file_paths, bool join_lines = false) : paths(std::move(file_paths)), join_lines(join_lines)
+    {
+        if (!paths.empty()) {
+            file = IFile(paths[0]);
+            prefetch_next();
+        }
+    }
+
+    MultiFileReader(const MultiFileReader &) = delete;
+    void operator=(const MultiFileReader &) = delete;
+
+    size_t get_file_index() const {return index;} // index of the file being read
+    const std::string &get_file_path() const // an empty string if the list of files is empty
+    {
+        static const std::string empty;
+        return paths.empty() ? empty : paths[index];
+    }
+
+    bool at_eof() // returns true only at the end of the last file
+    {
+        while (paths.empty() || file.at_eof() || (text_read && file.contains_only_bom()))
+            if (paths.empty() || !open_next())
+                return true;
+        return false;
+    }
+
+private:
+    bool at_text_eof()
+    {
+        text_read = true;
+        return at_eof();
+    }
+public:
+
+    uint8_t peek_byte()
+    {
+        if (at_eof())
+            throw UnexpectedEOF();
+        return file.peek_byte();
+    }
+
+    uint8_t read_byte()
+    {
+        if (at_eof())
+            throw UnexpectedEOF();
+        return file.read_byte();
+    }
+
+    template <bool handle_nl = true> void read_until(std::string &res, char delim, bool keep_delim = false) // does not cross file boundaries [a file end is a delimiter]
+    {
+        if (at_text_eof())
+            throw UnexpectedEOF();
+        file.read_until<handle_nl>(res, delim, keep_delim);
+    }
+
+    template <bool handle_nl = true> std::string read_until(char delim, bool keep_delim = false)
+    {
+        std::string r;
+        read_until<handle_nl>(r, delim, keep_delim);
+        return r;
+    }
+
+    void read_line(std::string &r, bool keep_newline = false)
+    {
+        if (at_text_eof())
+            throw UnexpectedEOF();
+        file.read_until<false>(r, '\n', true);
+        if (join_lines && (r.empty() || r.back() != '\n')) { // the line is continued in the next file
+            std::string continuation;
+            while ((r.empty() || r.back() != '\n') && !at_text_eof()) {
+                file.read_until<false>(continuation, '\n', true);
+                r += continuation;
+            }
+        }
+
+        if (!keep_newline) {
+            if (!r.empty() && r.back() == '\n')
+                r.pop_back();
+            if (!r.empty() && r.back() == '\r')
+                r.pop_back();
+        }
+        else
+            if (!r.empty() && r.back() == '\n' && r.length() >= 2 && r[r.length() - 2] == '\r')
+                r.erase(r.length() - 2, 1);
+    }
+
+    std::string read_line(bool keep_newline = false)
+    {
+        std::string r;
+        read_line(r, keep_newline);
+        return r;
+    }
+
+    size_t read_bytes_at_most(uint8_t *p, size_t count) // reads across file boundaries
+    {
+        size_t n = 0;
+        while (n < count && !at_eof())
+            n += file.read_bytes_at_most(p + n, count - n);
+        return n;
+    }
+
+    void read_bytes(uint8_t *p, size_t count)
+    {
+        if (read_bytes_at_most(p, count) != count)
+            throw UnexpectedEOF();
+    }
+
+    template <typename Struct> void read_struct(Struct &s)
+    {
+        read_bytes((uint8_t*)&s, sizeof(Struct));
+    }
+
+    std::vector<uint8_t> read_bytes(size_t count)
+    {
+        std::vector<uint8_t> r(count);
+        read_bytes(r.data(), count);
+        return r;
+    }
+
+    std::string read_text_to_end() // the contents of each file are processed as by `IFile::read_text_to_end()`
+    {
+        std::string r;
+        while (!at_text_eof())
+            r += file.read_text_to_end();
+        return r;
+    }
+};
@@ -1,19 +1,88 @@
 #pragma once
 #include <cstdint> // for uint8_t
 #include "FileHandle.hpp"
+#include "IFile.hpp" // for `OFile::write_from()`
 #include <memory> // for std::unique_ptr
 #include <vector>
+#include <string.h> // for memcpy and memchr [GCC]
+#include <type_traits> // for `std::is_arithmetic`
+#if defined(__x86_64__) || defined(_M_X64)
+#include <emmintrin.h> // SSE2 [always available on x86-64]
+#endif
 
 const size_t OFILE_DEFAULT_BUFFER_SIZE = 32*1024;
 
 class OFileBufferAlreadyAllocated {};
 
+struct OFileSizeHint // usage: `OFile f(fname, OFileSizeHint(expected_size));`
+{
+    int64_t expected_size;
+    bool keep_size;
+
+    explicit OFileSizeHint(int64_t expected_size, bool keep_size = false) : expected_size(expected_size), keep_size(keep_size) {}
+};
+
+struct OFileAtomicReplace {}; // usage: `OFile f(fname, OFileAtomicReplace());` [see `FileHandle::open_atomic_replace()`]
+
+enum class Endian
+{
+    little,
+    big,
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    native = big
+#else
+    native = little
+#endif
+};
+
+namespace detail
+{
+inline size_t encode_varint(uint64_t v, uint8_t *p) // writes up to 10 bytes; returns the number of bytes written
+{
+    size_t n = 0;
+    for (; v >= 0x80; v >>= 7)
+        p[n++] = uint8_t(v | 0x80);
+    p[n++] = uint8_t(v);
+    return n;
+}
+
+inline uint16_t swap_bytes(uint16_t v) {return uint16_t((v << 8) | (v >> 8));}
+inline uint32_t swap_bytes(uint32_t v) {return (uint32_t(swap_bytes(uint16_t(v))) << 16) | swap_bytes(uint16_t(v >> 16));}
+inline uint64_t swap_bytes(uint64_t v) {return (uint64_t(swap_bytes(uint32_t(v))) << 32) | swap_bytes(uint32_t(v >> 32));}
+
+// Copies `n` elements of `size` [2, 4 or 8] bytes from `src` to `dest` reversing the byte order of each element
+// [with SSE2, the bytes are swapped within 16-bit lanes by shifts, and then the lanes are reordered by `pshuflw`/`pshufhw`]
+template <size_t size> void copy_swapping_bytes(uint8_t *dest, const uint8_t *src, size_t n)
+{
+    size_t i = 0;
+#if defined(__x86_64__) || defined(_M_X64)
+    for (; i + 16 / size <= n; i += 16 / size) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(src + i * size));
+        v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+        if (size == 4)
+            v = _mm_shufflehi_epi16(_mm_shufflelo_epi16(v, 0xB1), 0xB1); // swaps adjacent 16-bit lanes
+        else if (size == 8)
+            v = _mm_shufflehi_epi16(_mm_shufflelo_epi16(v, 0x1B), 0x1B); // reverses the order of 4 16-bit lanes
+        _mm_storeu_si128((__m128i*)(dest + i * size), v);
+    }
+#endif
+    typedef typename std::conditional<size == 2, uint16_t, typename std::conditional<size == 4, uint32_t, uint64_t>::type>::type U;
+    for (; i < n; i++) {
+        U v;
+        memcpy(&v, src + i * size, size);
+        v = swap_bytes(v);
+        memcpy(dest + i * size, &v, size);
+    }
+}
+}
+
 class OFile
 {
 protected:
     detail::FileHandle<false> fh;
     std::unique_ptr<uint8_t[]> buffer;
     size_t buffer_pos = 0, buffer_capacity = OFILE_DEFAULT_BUFFER_SIZE;
+    bool crlf_newlines = false;
 
     void allocate_buffer()
     {
@@ -21,20 +90,64 @@ protected:
             buffer.reset(new uint8_t[buffer_capacity]);
     }
 
+    void flush_buffer()
+    {
+        if (buffer_pos != 0) {
+            fh.write(buffer.get(), buffer_pos);
+            buffer_pos = 0;
+        }
+    }
+
+    template <bool crlf, typename Char> void write_utf(const Char *p, const Char *end)
+    {
+        allocate_buffer();
+
+        while (true) {
+            // ASCII fast path: copy characters directly into the buffer until a non-ASCII character [or a newline in CRLF mode] is encountered
+            uint8_t *dest = buffer.get() + buffer_pos, *dest_start = dest;
+            for (const Char *chunk_end = p + (std::min)(size_t(end - p), buffer_capacity - buffer_pos); p < chunk_end; p++, dest++) {
+                if (uint32_t(*p) >= 0x80 || (crlf && *p == '\n'))
+                    break;
+                *dest = uint8_t(*p);
+            }
+            buffer_pos += dest - dest_start;
+            if (p == end)
+                return;
+            if (buffer_pos == buffer_capacity) {
+                flush_buffer();
+                continue;
+            }
+
+            // Slow path
+            char32_t ch = *p++;
+            if (sizeof(Char) == 2 && ch >= utf::UNI_SUR_HIGH_START && ch <= utf::UNI_SUR_HIGH_END && p < end
+                                  && char32_t(*p) >= utf::UNI_SUR_LOW_START && char32_t(*p) <= utf::UNI_SUR_LOW_END)
+                ch = ((ch - utf::UNI_SUR_HIGH_START) << utf::halfShift) + (*p++ - utf::UNI_SUR_LOW_START) + utf::halfBase;
+            write_char(ch);
+        }
+    }
+
 public:
     template <class... Args> OFile(Args&&... args) : fh(std::forward<Args>(args)...) {}
+    template <class Name> OFile(Name &&fname, OFileAtomicReplace) {if (!fh.open_atomic_replace(std::forward<Name>(fname))) throw FileOpenError();}
+    template <class Name> OFile(Name &&fname, OFileSizeHint hint) : fh(std::forward<Name>(fname)) {fh.reserve(hint.expected_size, hint.keep_size);} // the size hint is only a hint, so a failure to reserve space is ignored
     template <class... Args> bool open(Args&&... args) {return fh.open(std::forward<Args>(args)...);}
 #if !defined(_MSC_VER) || _MSC_VER > 1800
     OFile(OFile &&) = default;
 #else // unfortunately, MSVC 2013 doesn't support defaulted move constructors
-    OFile(OFile &&f) : fh(std::move(f.fh)), buffer(std::move(f.buffer)), buffer_pos(f.buffer_pos), buffer_capacity(f.buffer_capacity) {f.buffer_pos = 0;}
+    OFile(OFile &&f) : fh(std::move(f.fh)), buffer(std::move(f.buffer)), buffer_pos(f.buffer_pos), buffer_capacity(f.buffer_capacity), crlf_newlines(f.crlf_newlines) {f.buffer_pos = 0;}
 #endif
     OFile &operator=(OFile &&f)
     {
         move_assign(this, std::move(f));
         return *this;
     }
-    ~OFile() {flush();}
+    ~OFile()
+    {
+        if (fh.is_atomic_replace()) // not closed explicitly [e.g. because of an exception], so the replacement is discarded [by `~FileHandle()`]
+            return;
+        flush();
+    }
     void close()
     {
         flush();
@@ -42,6 +155,14 @@ public:
         //buffer_pos = 0;
     }
 
+    template <class Name> bool open_atomic_replace(Name &&fname) {return fh.open_atomic_replace(std::forward<Name>(fname));} // only `close()` commits the replacement
+
+    void discard() // closes the file without replacing the target file [only for files opened in atomic replacement mode]
+    {
+        buffer_pos = 0;
+        fh.discard();
+    }
+
     void set_buffer_size(size_t sz)
     {
         if (buffer != nullptr)
@@ -51,30 +172,58 @@ public:
 
     void flush()
     {
-        if (buffer_pos != 0) {
-            fh.write(buffer.get(), buffer_pos);
-            buffer_pos = 0;
-        }
+        flush_buffer();
+        if (fh.get_durability() == Durability::sync_on_flush && fh.has_data_to_sync())
+            fh.sync();
+    }
+
+    void set_durability(Durability d, std::chrono::microseconds time_window = std::chrono::microseconds(1000), uint64_t byte_window = 1024*1024) // see `FileHandle::set_durability()`
+    {
+        fh.set_durability(d, time_window, byte_window);
     }
 
+    void sync() // flushes the buffer and makes all written data durable
+    {
+        flush_buffer();
+        fh.sync();
+    }
+
+    // Makes durable only the data that has already been flushed. Unlike `sync()`, it does not touch the buffer, so in group commit mode it can be called
+    // concurrently from several threads (each thread calls `flush()` under the lock that serializes writes, and then `sync_flushed()` after releasing it).
+    void sync_flushed()
+    {
+        fh.sync();
+    }
+
+    CommitStats get_commit_stats() {return fh.get_commit_stats();}
+
+    // Hashes all data as it is written to the file [i.e. in `flush()` and direct writes of large blocks], so that a checksum is computed in the same pass.
+    // `checksum` must outlive writing; kernel-side copying in `write_from()` and `write_until()` is disabled while it is set.
+    void set_checksum(Checksum *checksum) {fh.checksum = checksum;}
+
     void seek(int64_t pos)
     {
-        flush();
+        flush_buffer();
         fh.seek(pos);
     }
 
+    bool reserve(int64_t expected_size, bool keep_size = false) // see `FileHandle::reserve()`
+    {
+        return fh.reserve(expected_size, keep_size);
+    }
+
     void write_byte(uint8_t b)
     {
         allocate_buffer();
         if (buffer_pos == buffer_capacity)
-            flush();
+            flush_buffer();
         buffer[buffer_pos++] = b;
     }
 
     void write(const void *vp, size_t sz)
     {
         if (sz > buffer_capacity) { // optimize large writes (avoid extra `write()` syscalls)
-            flush(); // first of all, write all of the remaining bytes in the buffer
+            flush_buffer(); // first of all, write all of the remaining bytes in the buffer
             fh.write(vp, sz);
             return;
         }
@@ -103,9 +252,227 @@ public:
         write(v.data(), v.size());
     }
 
+    template <typename Struct> void write_struct(const Struct &s) // counterpart of `IFile::read_struct()`
+    {
+        write(&s, sizeof(Struct));
+    }
+
+    // Writes an array of numbers in the given byte order; if it differs from the native byte order, the bytes are swapped while the numbers are copied into the buffer
+    template <typename T> void write_array(const T *data, size_t count, Endian endian = Endian::native)
+    {
+        static_assert(std::is_arithmetic<T>::value && (sizeof(T) == 1 || sizeof(T) == 2 || sizeof(T) == 4 || sizeof(T) == 8), "write_array() requires an array of numbers");
+        if (sizeof(T) == 1 || endian == Endian::native) {
+            write(data, count * sizeof(T));
+            return;
+        }
+
+        allocate_buffer();
+        const uint8_t *p = (const uint8_t*)data;
+        while (count != 0) {
+            size_t n = (std::min)((buffer_capacity - buffer_pos) / sizeof(T), count);
+            if (n == 0) {
+                if (buffer_pos == 0) { // the buffer is smaller than one element
+                    uint8_t b[sizeof(T)];
+                    detail::copy_swapping_bytes<sizeof(T)>(b, p, 1);
+                    fh.write(b, sizeof(T));
+                    p += sizeof(T);
+                    count--;
+                    continue;
+                }
+                flush_buffer();
+                continue;
+            }
+            detail::copy_swapping_bytes<sizeof(T)>(buffer.get() + buffer_pos, p, n);
+            buffer_pos += n * sizeof(T);
+            p += n * sizeof(T);
+            count -= n;
+        }
+    }
+
+    template <typename T> void write_array(const std::vector<T> &v, Endian endian = Endian::native)
+    {
+        write_array(v.data(), v.size(), endian);
+    }
+
+    // Writes a varint [LEB128, as in protobuf; counterpart of `IFile::read_varint()`] directly into the buffer [negative values are written as 10-byte varints, as in protobuf]
+    void write_varint(uint64_t v)
+    {
+        allocate_buffer();
+        if (buffer_capacity - buffer_pos < 10) { // the only capacity check
+            flush_buffer();
+            if (buffer_capacity < 10) {
+                uint8_t b[10];
+                write(b, detail::encode_varint(v, b));
+                return;
+            }
+        }
+        buffer_pos += detail::encode_varint(v, buffer.get() + buffer_pos);
+    }
+
+    void write_zigzag(int64_t v) // counterpart of `IFile::read_zigzag()`
+    {
+        write_varint((uint64_t(v) << 1) ^ uint64_t(v >> 63));
+    }
+
+    // Writes an RFC 3339 timestamp directly into the buffer [see `RFC3339Formatter`]
+    void write_rfc3339(UnixNanotime t, RFC3339Formatter &formatter)
+    {
+        allocate_buffer();
+        if (buffer_capacity - buffer_pos < RFC3339Formatter::MAX_LENGTH) {
+            flush_buffer();
+            if (buffer_capacity < RFC3339Formatter::MAX_LENGTH) {
+                char b[RFC3339Formatter::MAX_LENGTH];
+                write(b, formatter.format(t, b));
+                return;
+            }
+        }
+        buffer_pos += formatter.format(t, (char*)buffer.get() + buffer_pos);
+    }
+
     void write(utf::std::string_view sv)
     {
-        write(sv.data(), sv.size());
+        if (!crlf_newlines) {
+            write(sv.data(), sv.size());
+            return;
+        }
+
+        const char *p = sv.data(), *end = p + sv.size();
+        while (const char *nl = (const char*)memchr(p, '\n', end - p)) {
+            write(p, nl - p);
+            write("\r\n", 2);
+            p = nl + 1;
+        }
+        write(p, end - p);
+    }
+
+    // UTF-16 and UTF-32 strings are encoded in UTF-8 directly into the buffer (without a temporary `utf::as_str8()` copy)
+    void write(utf::std::u16string_view sv)
+    {
+        if (crlf_newlines)
+            write_utf<true >(sv.begin(), sv.end());
+        else
+            write_utf<false>(sv.begin(), sv.end());
+    }
+
+    void write(utf::std::u32string_view sv)
+    {
+        if (crlf_newlines)
+            write_utf<true >(sv.begin(), sv.end());
+        else
+            write_utf<false>(sv.begin(), sv.end());
+    }
+
+    void write_char(char32_t ch) // writes a Unicode character encoded in UTF-8 (counterpart of `IFile::read_char()`)
+    {
+        if (ch < 0x80) {
+            if (ch == '\n' && crlf_newlines)
+                write_byte('\r');
+            write_byte(uint8_t(ch));
+            return;
+        }
+
+        uint8_t b[4];
+        write(b, utf::encode(ch, b)); // unpaired surrogates and out-of-range values are replaced with U+FFFD
+    }
+
+    void set_crlf_newlines(bool crlf = true) // when enabled, text writes [`write(string_view)`, `write(u16string_view)`, `write(u32string_view)` and `write_char()`] convert "\n" to "\r\n"; `write_byte()` and binary writes are not affected
+    {
+        crlf_newlines = crlf;
+    }
+
+    // Copies `n` bytes [or everything up to the end of `f` if `n` is -1] from the current position of `f`, and returns the number of bytes copied.
+    // When both files allow it, the data is copied within the kernel [`copy_file_range()`, `sendfile()` or `splice()`] without passing through user space.
+    int64_t write_from(IFile &f, int64_t n = -1)
+    {
+        uint64_t remaining = n == -1 ? UINT64_MAX : uint64_t(n);
+        int64_t copied = 0;
+
+        // First of all, write the bytes that are already in the buffer of `f`
+        size_t k = (size_t)(std::min)(uint64_t(f.buffer_size - f.buffer_pos), remaining);
+        if (k != 0)
+            write(f.buffer.get() + f.buffer_pos, k);
+        f.buffer_pos += k;
+        remaining -= k;
+        copied += k;
+
+#ifndef _WIN32
+        detail::KernelCopy method = detail::KernelCopy::none;
+        if (remaining > buffer_capacity && !f.is_eof_reached && fh.checksum == nullptr && f.fh.checksum == nullptr) // data copied within the kernel can not be hashed
+            method = f.fh.get_file_size() != -2 ? detail::KernelCopy::copy_file_range : f.fh.is_pipe() ? detail::KernelCopy::splice : detail::KernelCopy::none;
+        if (method != detail::KernelCopy::none) { // kernel-side copying is used only for regular input files and pipes
+            flush_buffer();
+            f.file_pos_of_buffer_start += f.buffer_size; // the buffer of `f` is empty now, and the file position of `f.fh` is right after it
+            f.buffer_pos = f.buffer_size = 0;
+            if (f.block_cache != nullptr) // the file position of `f.fh` is not advanced on block cache hits, so set it via a zero-length read at an explicit position
+                f.fh.read(f.buffer.get(), 0, f.file_pos_of_buffer_start);
+
+            while (remaining != 0) {
+                int64_t r = fh.copy_from(f.fh, (size_t)(std::min)(remaining, uint64_t(SIZE_MAX)), method);
+                if (r == -1) // not supported, so fall back to buffered copying
+                    break;
+                if (r == 0) {
+                    if (method == detail::KernelCopy::copy_file_range && f.file_pos_of_buffer_start < f.fh.get_file_size()) { // `copy_file_range()` returns 0 for some special files [e.g. in /proc or /sys]
+                        method = detail::KernelCopy::sendfile;
+                        continue;
+                    }
+                    break;
+                }
+                f.file_pos_of_buffer_start += r;
+                remaining -= r;
+                copied += r;
+            }
+        }
+#endif
+
+        // Buffered copying
+        while (remaining != 0 && !f.at_eof()) {
+            k = (size_t)(std::min)(uint64_t(f.buffer_size - f.buffer_pos), remaining);
+            write(f.buffer.get() + f.buffer_pos, k);
+            f.buffer_pos += k;
+            remaining -= k;
+            copied += k;
+        }
+        if (n != -1 && remaining != 0)
+            throw UnexpectedEOF();
+        return copied;
+    }
+
+    // Copies data from the current position of `f` up to the first `delim` [which is consumed, and written only if `keep_delim` is true] or the end of `f`,
+    // and returns the number of bytes consumed from `f`. If `f` is a pipe, long spans of data are moved via `tee()` and `splice()`.
+    int64_t write_until(IFile &f, char delim, bool keep_delim = false) // the default matches `IFile::read_until()`
+    {
+        int64_t consumed = 0;
+#ifdef __linux__
+        bool try_kernel_copy = fh.checksum == nullptr && f.fh.checksum == nullptr; // data copied within the kernel can not be hashed
+#endif
+        while (!f.at_eof()) {
+            const uint8_t *start = f.buffer.get() + f.buffer_pos;
+            size_t avail = f.buffer_size - f.buffer_pos;
+            if (const uint8_t *p = (const uint8_t*)memchr(start, delim, avail)) {
+                size_t k = p - start + 1;
+                write(start, keep_delim ? k : k - 1);
+                f.buffer_pos += k;
+                return consumed + k;
+            }
+            write(start, avail);
+            f.buffer_pos += avail;
+            consumed += avail;
+
+#ifdef __linux__
+            if (try_kernel_copy && !f.is_eof_reached && f.fh.is_pipe()) { // the delimiter is far away, so move the rest of data within the kernel
+                flush_buffer();
+                f.file_pos_of_buffer_start += f.buffer_size;
+                f.buffer_pos = f.buffer_size = 0;
+                int64_t r = fh.copy_until_from(f.fh, delim, keep_delim);
+                if (r != -1) {
+                    f.file_pos_of_buffer_start += r;
+                    return consumed + r;
+                }
+            }
+            try_kernel_copy = false;
+#endif
+        }
+        return consumed;
     }
 
     void set_last_write_time(UnixNanotime t)
@@ -113,3 +480,15 @@ public:
         fh.set_last_write_time(t);
     }
 };
+
+template <class Src, class Dst> int64_t copy_file(const Src &src, const Dst &dst) // returns the number of bytes copied; see `OFile::write_from()`
+{
+    IFile in(src);
+    OFile out(dst);
+    int64_t r = out.write_from(in);
+    out.close();
+    return r;
+}
+
+inline int64_t IFile::forward_bytes(OFile &out, int64_t n) {return out.write_from(*this, n);}
+inline int64_t IFile::forward_until(OFile &out, char delim, bool keep_delim) {return out.write_until(*this, delim, keep_delim);}
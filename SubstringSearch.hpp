@@ -0,0 +1,158 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h> // for `memchr()` and `memcmp()`
+
+#if defined(__x86_64__) || defined(_M_X64)
+#include <emmintrin.h> // SSE2 [always available on x86-64]
+#if defined(__GNUC__)
+#include <immintrin.h> // AVX2 [used via `target("avx2")` after a runtime check]
+#elif defined(_MSC_VER)
+#include <intrin.h> // for `_BitScanForward()`
+#endif
+#endif
+
+// Vectorized substring search and byte counting [used by `IFile::find()` and `IFile::count_lines()`]
+namespace detail
+{
+/*
+Substring search with a filter on the first and the last byte of the needle [>[http://0x80.pl/articles/simd-strfind.html]:‘generic SIMD’]:
+16 [SSE2] or 32 [AVX2] positions are checked at once by comparing the bytes at these positions with the first byte of the needle and the bytes at
+`m - 1` positions further with its last byte, and only the positions passing both comparisons are verified with `memcmp()`.
+*/
+inline const uint8_t *find_substring_scalar(const uint8_t *s, size_t n, const uint8_t *needle, size_t m) // `m` >= 2
+{
+    const uint8_t *end = s + n - m + 1; // the end of possible match positions
+    while (s < end) {
+        s = (const uint8_t*)memchr(s, needle[0], end - s);
+        if (s == nullptr)
+            return nullptr;
+        if (s[m - 1] == needle[m - 1] && memcmp(s + 1, needle + 1, m - 2) == 0)
+            return s;
+        s++;
+    }
+    return nullptr;
+}
+
+#if defined(__x86_64__) || defined(_M_X64)
+inline int lowest_set_bit(uint32_t mask)
+{
+#ifdef _MSC_VER
+    unsigned long i;
+    _BitScanForward(&i, mask);
+    return (int)i;
+#else
+    return __builtin_ctz(mask);
+#endif
+}
+
+inline const uint8_t *find_substring_sse2(const uint8_t *s, size_t n, const uint8_t *needle, size_t m)
+{
+    const __m128i first = _mm_set1_epi8((char)needle[0]), last = _mm_set1_epi8((char)needle[m - 1]);
+    size_t i = 0;
+    for (; i + m - 1 + 16 <= n; i += 16) {
+        __m128i block_first = _mm_loadu_si128((const __m128i*)(s + i)), block_last = _mm_loadu_si128((const __m128i*)(s + i + m - 1));
+        uint32_t mask = (uint32_t)_mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(block_first, first), _mm_cmpeq_epi8(block_last, last)));
+        for (; mask != 0; mask &= mask - 1) {
+            size_t pos = i + lowest_set_bit(mask);
+            if (memcmp(s + pos + 1, needle + 1, m - 2) == 0)
+                return s + pos;
+        }
+    }
+    return find_substring_scalar(s + i, n - i, needle, m);
+}
+
+#ifdef __GNUC__
+__attribute__((target("avx2"))) inline const uint8_t *find_substring_avx2(const uint8_t *s, size_t n, const uint8_t *needle, size_t m)
+{
+    const __m256i first = _mm256_set1_epi8((char)needle[0]), last = _mm256_set1_epi8((char)needle[m - 1]);
+    size_t i = 0;
+    for (; i + m - 1 + 32 <= n; i += 32) {
+        __m256i block_first = _mm256_loadu_si256((const __m256i*)(s + i)), block_last = _mm256_loadu_si256((const __m256i*)(s + i + m - 1));
+        uint32_t mask = (uint32_t)_mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(block_first, first), _mm256_cmpeq_epi8(block_last, last)));
+        for (; mask != 0; mask &= mask - 1) {
+            size_t pos = i + lowest_set_bit(mask);
+            if (memcmp(s + pos + 1, needle + 1, m - 2) == 0)
+                return s + pos;
+        }
+    }
+    return find_substring_sse2(s + i, n - i, needle, m);
+}
+inline bool avx2_supported() {static const bool r = __builtin_cpu_supports("avx2"); return r;}
+#endif
+#endif
+
+// Returns a pointer to the first occurrence of `needle` [of `m` bytes] in `s` [of `n` bytes], or nullptr
+inline const uint8_t *find_substring(const uint8_t *s, size_t n, const uint8_t *needle, size_t m)
+{
+    if (m > n)
+        return nullptr;
+    if (m <= 1)
+        return m == 0 ? s : (const uint8_t*)memchr(s, needle[0], n);
+#if defined(__x86_64__) && defined(__GNUC__)
+    if (avx2_supported())
+        return find_substring_avx2(s, n, needle, m);
+    return find_substring_sse2(s, n, needle, m);
+#elif defined(_M_X64)
+    return find_substring_sse2(s, n, needle, m);
+#else
+    return find_substring_scalar(s, n, needle, m);
+#endif
+}
+
+// Byte counting [e.g. of newlines]: the comparison results [-1 for equal bytes] are subtracted from 8-bit counters, which are summed into 64-bit counters
+// via `psadbw` every 255 iterations before they can overflow
+inline size_t count_byte_scalar(const uint8_t *p, size_t n, uint8_t c)
+{
+    size_t count = 0;
+    for (size_t i = 0; i < n; i++)
+        count += p[i] == c;
+    return count;
+}
+
+#if defined(__x86_64__) || defined(_M_X64)
+inline size_t count_byte_sse2(const uint8_t *p, size_t n, uint8_t c)
+{
+    const __m128i cv = _mm_set1_epi8((char)c), zero = _mm_setzero_si128();
+    __m128i total = zero;
+    size_t i = 0;
+    while (i + 16 <= n) {
+        __m128i counters = zero;
+        for (size_t k = 0; k < 255 && i + 16 <= n; k++, i += 16)
+            counters = _mm_sub_epi8(counters, _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(p + i)), cv));
+        total = _mm_add_epi64(total, _mm_sad_epu8(counters, zero));
+    }
+    return size_t(_mm_cvtsi128_si64(total) + _mm_cvtsi128_si64(_mm_unpackhi_epi64(total, total))) + count_byte_scalar(p + i, n - i, c);
+}
+
+#ifdef __GNUC__
+__attribute__((target("avx2"))) inline size_t count_byte_avx2(const uint8_t *p, size_t n, uint8_t c)
+{
+    const __m256i cv = _mm256_set1_epi8((char)c), zero = _mm256_setzero_si256();
+    __m256i total = zero;
+    size_t i = 0;
+    while (i + 32 <= n) {
+        __m256i counters = zero;
+        for (size_t k = 0; k < 255 && i + 32 <= n; k++, i += 32)
+            counters = _mm256_sub_epi8(counters, _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(p + i)), cv));
+        total = _mm256_add_epi64(total, _mm256_sad_epu8(counters, zero));
+    }
+    __m128i t = _mm_add_epi64(_mm256_castsi256_si128(total), _mm256_extracti128_si256(total, 1));
+    return size_t(_mm_cvtsi128_si64(t) + _mm_cvtsi128_si64(_mm_unpackhi_epi64(t, t))) + count_byte_scalar(p + i, n - i, c);
+}
+#endif
+#endif
+
+inline size_t count_byte(const uint8_t *p, size_t n, uint8_t c)
+{
+#if defined(__x86_64__) && defined(__GNUC__)
+    if (avx2_supported())
+        return count_byte_avx2(p, n, c);
+    return count_byte_sse2(p, n, c);
+#elif defined(_M_X64)
+    return count_byte_sse2(p, n, c);
+#else
+    return count_byte_scalar(p, n, c);
+#endif
+}
+}
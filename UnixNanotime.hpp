@@ -1,4 +1,10 @@
 #pragma once
+#include <stdint.h>
+#include <string.h> // for `memcpy()`
+#include <time.h> // for `time_t`
+#include <string>
+
+class RFC3339ParseError {};
 
 class UnixNanotime
 {
@@ -41,5 +47,245 @@ public:
         }
     }
 
+    // Splits the time into whole seconds [rounded down, also for times before the epoch] and nanoseconds [0..999999999]
+    void to_seconds(int64_t &seconds, uint32_t &nanoseconds) const
+    {
+        if (nanoseconds_since_epoch < BOUNDARY) {
+            seconds     = int64_t(nanoseconds_since_epoch / 1000000000u);
+            nanoseconds = uint32_t(nanoseconds_since_epoch % 1000000000u);
+        }
+        else {
+            int64_t n = int64_t(nanoseconds_since_epoch);
+            seconds     = n / 1000000000 - (n % 1000000000 != 0);
+            nanoseconds = uint32_t(n - seconds * 1000000000);
+        }
+    }
+
+    /*
+    RFC 3339 [ISO 8601] timestamps, e.g. "2024-03-01T12:34:56.123456789Z" or "2024-03-01T18:04:56.123+05:30"
+    [see also `RFC3339Formatter`, which formats series of timestamps faster, and `OFile::write_rfc3339()`].
+    */
+    std::string to_rfc3339(int fraction_digits = 9, int utc_offset_minutes = 0) const;
+
+    // Parses an RFC 3339 timestamp [the separator may be 'T', 't' or ' ', and any number of fraction digits is accepted, but digits after the 9th are ignored];
+    // if `consumed` is nullptr, the whole string must be a timestamp, otherwise the length of the timestamp at the beginning of `s` is stored in `*consumed`
+    static UnixNanotime parse_rfc3339(const char *s, size_t len, size_t *consumed = nullptr);
+    static UnixNanotime parse_rfc3339(const std::string &s) {return parse_rfc3339(s.data(), s.size());}
+
     bool operator==(const UnixNanotime nt) const {return nanoseconds_since_epoch == nt.nanoseconds_since_epoch;}
+    bool operator!=(const UnixNanotime nt) const {return nanoseconds_since_epoch != nt.nanoseconds_since_epoch;}
 };
+
+namespace detail
+{
+// Conversions between days since the epoch and dates of the proleptic Gregorian calendar [http://howardhinnant.github.io/date_algorithms.html]
+inline void civil_from_days(int64_t z, int &year, unsigned &month, unsigned &day)
+{
+    z += 719468;
+    int64_t era = (z >= 0 ? z : z - 146096) / 146097;
+    unsigned doe = unsigned(z - era * 146097);                              // [0, 146096]
+    unsigned yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;   // [0, 399]
+    unsigned doy = doe - (365 * yoe + yoe / 4 - yoe / 100);                 // [0, 365]
+    unsigned mp = (5 * doy + 2) / 153;                                      // [0, 11], counting from March
+    day = doy - (153 * mp + 2) / 5 + 1;
+    month = mp < 10 ? mp + 3 : mp - 9;
+    year = int(yoe + era * 400) + (month <= 2);
+}
+
+inline int64_t days_from_civil(int year, unsigned month, unsigned day)
+{
+    year -= month <= 2;
+    int64_t era = (year >= 0 ? year : year - 399) / 400;
+    unsigned yoe = unsigned(year - era * 400);
+    unsigned doy = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+    unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + int64_t(doe) - 719468;
+}
+
+inline void write_2_digits(char *p, unsigned v) // `v` < 100
+{
+    static const char digit_pairs[] =
+        "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+        "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+        "8081828384858687888990919293949596979899";
+    memcpy(p, digit_pairs + v * 2, 2);
+}
+}
+
+/*
+Formats series of timestamps [e.g. of log records] in RFC 3339 format with a fixed number of fraction digits and a fixed UTC offset:
+    RFC3339Formatter formatter(6);
+    char buf[RFC3339Formatter::MAX_LENGTH];
+    size_t len = formatter.format(t, buf); // "2024-03-01T12:34:56.123456Z"
+The date and the time of day of the last formatted second are cached, so that only the fraction is formatted for consecutive timestamps within the same second
+[and the calendar is not recomputed within the same day].
+*/
+class RFC3339Formatter
+{
+    int64_t cached_second = INT64_MIN, cached_day = INT64_MIN;
+    char prefix[19]; // "YYYY-MM-DDTHH:MM:SS" of `cached_second`
+    char suffix[6]; // "Z" or "+hh:mm"
+    size_t suffix_len;
+    int fraction_digits;
+    int offset_seconds;
+
+public:
+    static const size_t MAX_LENGTH = 35; // "YYYY-MM-DDTHH:MM:SS.nnnnnnnnn+hh:mm"
+
+    explicit RFC3339Formatter(int fraction_digits = 9, int utc_offset_minutes = 0)
+        : fraction_digits(fraction_digits < 0 ? 0 : fraction_digits > 9 ? 9 : fraction_digits), offset_seconds(utc_offset_minutes * 60)
+    {
+        if (utc_offset_minutes == 0) {
+            suffix[0] = 'Z';
+            suffix_len = 1;
+        }
+        else {
+            unsigned m = utc_offset_minutes < 0 ? -utc_offset_minutes : utc_offset_minutes;
+            suffix[0] = utc_offset_minutes < 0 ? '-' : '+';
+            detail::write_2_digits(suffix + 1, m / 60 % 100);
+            suffix[3] = ':';
+            detail::write_2_digits(suffix + 4, m % 60);
+            suffix_len = 6;
+        }
+        memcpy(prefix, "0000-00-00T00:00:00", 19);
+    }
+
+    // Writes the timestamp into `buf`, which must have room for `MAX_LENGTH` chars [a terminating zero is not written], and returns its length
+    size_t format(UnixNanotime t, char *buf)
+    {
+        int64_t second;
+        uint32_t nanoseconds;
+        t.to_seconds(second, nanoseconds);
+        second += offset_seconds;
+
+        if (second != cached_second) {
+            int64_t day = second / 86400 - (second % 86400 < 0);
+            if (day != cached_day) {
+                int year;
+                unsigned month, mday;
+                detail::civil_from_days(day, year, month, mday);
+                detail::write_2_digits(prefix, unsigned(year) / 100 % 100);
+                detail::write_2_digits(prefix + 2, unsigned(year) % 100);
+                detail::write_2_digits(prefix + 5, month);
+                detail::write_2_digits(prefix + 8, mday);
+                cached_day = day;
+            }
+            unsigned s = unsigned(second - day * 86400);
+            detail::write_2_digits(prefix + 11, s / 3600);
+            detail::write_2_digits(prefix + 14, s / 60 % 60);
+            detail::write_2_digits(prefix + 17, s % 60);
+            cached_second = second;
+        }
+
+        memcpy(buf, prefix, 19);
+        char *p = buf + 19;
+        if (fraction_digits != 0) {
+            *p = '.';
+            p[1] = char('0' + nanoseconds / 100000000); // all 9 digits are written, and the unneeded ones are overwritten by the suffix
+            detail::write_2_digits(p + 2, nanoseconds / 1000000 % 100);
+            detail::write_2_digits(p + 4, nanoseconds / 10000 % 100);
+            detail::write_2_digits(p + 6, nanoseconds / 100 % 100);
+            detail::write_2_digits(p + 8, nanoseconds % 100);
+            p += 1 + fraction_digits;
+        }
+        memcpy(p, suffix, suffix_len);
+        return p + suffix_len - buf;
+    }
+
+    std::string format(UnixNanotime t)
+    {
+        char buf[MAX_LENGTH];
+        return std::string(buf, format(t, buf));
+    }
+};
+
+inline std::string UnixNanotime::to_rfc3339(int fraction_digits, int utc_offset_minutes) const
+{
+    return RFC3339Formatter(fraction_digits, utc_offset_minutes).format(*this);
+}
+
+inline UnixNanotime UnixNanotime::parse_rfc3339(const char *s, size_t len, size_t *consumed)
+{
+    struct Parser
+    {
+        const char *s;
+        size_t len;
+
+        unsigned digits(size_t pos, size_t n) const // parses `n` digits at `pos`
+        {
+            if (pos + n > len)
+                throw RFC3339ParseError();
+            unsigned v = 0;
+            for (size_t i = pos; i < pos + n; i++) {
+                unsigned d = unsigned(s[i]) - '0';
+                if (d > 9)
+                    throw RFC3339ParseError();
+                v = v * 10 + d;
+            }
+            return v;
+        }
+
+        void expect(size_t pos, char c) const
+        {
+            if (pos >= len || s[pos] != c)
+                throw RFC3339ParseError();
+        }
+    } p = {s, len};
+
+    int year = int(p.digits(0, 4));
+    p.expect(4, '-');
+    unsigned month = p.digits(5, 2);
+    p.expect(7, '-');
+    unsigned day = p.digits(8, 2);
+    if (len <= 10 || (s[10] != 'T' && s[10] != 't' && s[10] != ' '))
+        throw RFC3339ParseError();
+    unsigned hour = p.digits(11, 2);
+    p.expect(13, ':');
+    unsigned minute = p.digits(14, 2);
+    p.expect(16, ':');
+    unsigned second = p.digits(17, 2);
+
+    static const unsigned char days_in_month[] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+    bool leap_year = year % 4 == 0 && (year % 100 != 0 || year % 400 == 0);
+    if (month - 1 > 11 || day == 0 || day > days_in_month[month - 1] + unsigned(month == 2 && leap_year) || hour > 23 || minute > 59 || second > 60) // [a leap second is counted as the first second of the next minute]
+        throw RFC3339ParseError();
+
+    // Fraction of a second
+    size_t pos = 19;
+    uint32_t nanoseconds = 0;
+    if (pos < len && s[pos] == '.') {
+        pos++;
+        size_t start = pos;
+        uint32_t scale = 100000000;
+        for (; pos < len && unsigned(s[pos]) - '0' <= 9; pos++, scale /= 10)
+            nanoseconds += (s[pos] - '0') * scale; // `scale` becomes 0 after the 9th digit
+        if (pos == start)
+            throw RFC3339ParseError();
+    }
+
+    // UTC offset
+    int offset_seconds = 0;
+    if (pos < len && (s[pos] == 'Z' || s[pos] == 'z'))
+        pos++;
+    else if (pos < len && (s[pos] == '+' || s[pos] == '-')) {
+        unsigned offset_hours = p.digits(pos + 1, 2);
+        p.expect(pos + 3, ':');
+        unsigned offset_minutes = p.digits(pos + 4, 2);
+        if (offset_hours > 23 || offset_minutes > 59)
+            throw RFC3339ParseError();
+        offset_seconds = int(offset_hours * 3600 + offset_minutes * 60) * (s[pos] == '-' ? -1 : 1);
+        pos += 6;
+    }
+    else
+        throw RFC3339ParseError();
+
+    if (consumed != nullptr)
+        *consumed = pos;
+    else if (pos != len)
+        throw RFC3339ParseError();
+
+    int64_t seconds = detail::days_from_civil(year, month, day) * 86400 + hour * 3600 + minute * 60 + second - offset_seconds;
+    if (seconds < -2305843009 || seconds > 16140901063) // the range of `UnixNanotime` [from 1896-12-06 to 2481-06-25]
+        throw RFC3339ParseError();
+    return from_nanotime_t(uint64_t(seconds) * 1000000000u + nanoseconds);
+}
@@ -360,6 +360,48 @@ namespace utf {
             *target++ = static_cast<char>(*midp++);
     }
 
+    // Writes at most 4 bytes to `target` and returns the number of bytes
+    // written
+    static inline size_t encode(char32_t ch, uint8_t* target) {
+        unsigned short bytesToWrite = 0;
+
+        /* Figure out how many bytes the result will require */
+        if (ch < 0x80u)
+            bytesToWrite = 1;
+        else if (ch < 0x800u)
+            bytesToWrite = 2;
+        else if (ch >= UNI_SUR_HIGH_START && ch <= UNI_SUR_LOW_END) {
+            bytesToWrite = 3;
+            ch = UNI_REPLACEMENT_CHAR;
+        } else if (ch < 0x10000u)
+            bytesToWrite = 3;
+        else if (ch <= UNI_MAX_LEGAL_UTF32)
+            bytesToWrite = 4;
+        else {
+            bytesToWrite = 3;
+            ch = UNI_REPLACEMENT_CHAR;
+        }
+
+        uint8_t* p = target + bytesToWrite;
+        switch (bytesToWrite) { /* note: everything falls through. */
+            case 4:
+                *--p = static_cast<uint8_t>((ch | byteMark) & byteMask);
+                ch >>= 6;
+                //[[fallthrough]];
+            case 3:
+                *--p = static_cast<uint8_t>((ch | byteMark) & byteMask);
+                ch >>= 6;
+                //[[fallthrough]];
+            case 2:
+                *--p = static_cast<uint8_t>((ch | byteMark) & byteMask);
+                ch >>= 6;
+                //[[fallthrough]];
+            case 1:
+                *--p = static_cast<uint8_t>(ch | firstByteMark[bytesToWrite]);
+        }
+        return bytesToWrite;
+    }
+
 #ifdef __cpp_lib_char8_t
     static inline void encode(
         char32_t ch,